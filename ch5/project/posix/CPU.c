@@ -1,12 +1,340 @@
 /**
  * "Virtual" CPU that also maintains track of system time.
+ *
+ * The CPU is a discrete-event simulation: its clock moves on when a
+ * task runs for a slice, or when there is nothing to run and it idles
+ * until the next task arrives. Tasks are handed to the scheduler's
+ * add() as they arrive, and add() numbers them 0, 1, 2, ... in that
+ * order (their tid), which is how the CPU keeps track of them.
+ *
+ * The machine may have several CPUs, each with a clock of its own.
+ * A scheduler for them asks next_cpu() which CPU is free first and
+ * runs a task there with run_on(); the global clock is always the
+ * earliest of them, so events still happen in order. The single CPU
+ * schedulers use run() and idle(), which are CPU 0.
  */
 
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "task.h"
+#include "cpu.h"
+#include "schedulers.h"
+#include "trace.h"
 
-// run this task for the specified time slice
+struct machine machine = { 1, 0, 0, 10 * QUANTUM };
+
+// what the CPU knows about a task, by tid
+struct account {
+    long arrival;
+    long burst;
+    long remaining;
+    long ready;         // when its last slice ended, or it arrived
+    long first_run;     // -1 until it has run
+    long completion;    // -1 until it is done
+    int cpu;            // the CPU it last ran on, or -1
+};
+
+// what each CPU has been doing
+struct processor {
+    long free_at;       // when it is free to run the next slice
+    long busy;          // time spent running tasks
+    long switches;      // context switches
+    long migrations;    // tasks that came from another CPU
+    int last;           // tid of the task that ran last
+    int parked;         // idle until a task arrives or it is woken
+};
+
+static struct trace *trace;
+static size_t *order;           // records in arrival order, or NULL if the trace
+                                // is already in arrival order
+static struct account *accounts;
+static struct processor *cpus;
+static size_t arrived;          // tasks handed to add() so far
+static size_t completed;
+static int verbosity;
+
+static long now;                // the clock
+static long finish;             // when the last slice ended
+
+// the record of the i-th task to arrive
+static struct trace_record *nth(size_t i) {
+    return &trace->records[order != NULL ? order[i] : i];
+}
+
+static int earlier(const void *a, const void *b) {
+    size_t i = *(const size_t *) a, j = *(const size_t *) b;
+    uint32_t x = trace->records[i].arrival, y = trace->records[j].arrival;
+
+    if (x != y)
+        return x < y ? -1 : 1;
+    return i < j ? -1 : i > j;
+}
+
+static void *allocate(size_t size) {
+    void *p = calloc(1, size);
+
+    if (p == NULL) {
+        fprintf(stderr, "cpu: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// log an event, with the CPU it happened on if there is more than one
+static void event(long time, int cpu, const char *name, const char *what) {
+    if (machine.cpus > 1)
+        printf("%10ld: cpu %d: [%s] %s\n", time, cpu, name, what);
+    else
+        printf("%10ld: [%s] %s\n", time, name, what);
+}
+
+// hand every task that has arrived by now to the scheduler
+static void deliver(void) {
+    while (arrived < trace->count && nth(arrived)->arrival <= now) {
+        struct trace_record *r = nth(arrived);
+        struct account *a = &accounts[arrived++];
+
+        a->arrival = a->ready = r->arrival;
+        a->burst = a->remaining = r->burst;
+        a->first_run = a->completion = -1;
+        a->cpu = -1;
+        if (verbosity > 1)
+            printf("%10ld: [%s] arrives\n", (long) r->arrival, trace->names + r->name);
+
+        add(trace->names + r->name, r->priority, r->burst);
+    }
+}
+
+// start the clock
+void start(struct trace *t, int v) {
+    size_t i;
+    int c;
+
+    if (machine.cpus < 1 || machine.cpus > MAX_CPUS) {
+        fprintf(stderr, "cpu: there can be 1 to %d CPUs\n", MAX_CPUS);
+        exit(1);
+    }
+
+    trace = t;
+    verbosity = v;
+    accounts = allocate(sizeof(struct account) * (trace->count + 1));
+    cpus = allocate(sizeof(struct processor) * machine.cpus);
+    for (c = 0; c < machine.cpus; c++)
+        cpus[c].last = -1;
+
+    // tasks arrive in the order of the schedule unless their arrival
+    // times say otherwise
+    for (i = 1; i < trace->count && trace->records[i - 1].arrival <= trace->records[i].arrival; i++)
+        ;
+    if (i < trace->count) {
+        order = allocate(sizeof(size_t) * trace->count);
+        for (i = 0; i < trace->count; i++)
+            order[i] = i;
+        qsort(order, trace->count, sizeof(size_t), earlier);
+    }
+
+    deliver();
+}
+
+long current_time(void) {
+    return now;
+}
+
+// run this task on a CPU for the specified time slice; on a single
+// CPU, also hand over the tasks that arrive before the slice ends
+static void execute(int cpu, Task *task, int slice, int single) {
+    struct processor *p = &cpus[cpu];
+    struct account *a;
+    long begin;
+
+    if (task->tid < 0 || (size_t) task->tid >= arrived) {
+        fprintf(stderr, "cpu: task [%s] has tid %d, but only %zu tasks have arrived\n",
+            task->name, task->tid, arrived);
+        exit(1);
+    }
+    a = &accounts[task->tid];
+
+    if (verbosity > 0) {
+        if (machine.cpus > 1)
+            printf("CPU %d: ", cpu);
+        printf("Running task = [%s] [%d] [%d] for %d units.\n",task->name, task->priority, task->burst, slice);
+    }
+
+    // a task runs on one CPU at a time: one that another CPU took
+    // over waits there until its last slice has ended
+    begin = p->free_at > a->ready ? p->free_at : a->ready;
+
+    if (p->last != task->tid) {
+        if (p->last >= 0) {
+            p->switches++;
+            if (verbosity > 1)
+                event(begin, cpu, task->name, "is switched to");
+        }
+        p->last = task->tid;
+    }
+    if (a->cpu >= 0 && a->cpu != cpu) {
+        p->migrations++;
+        p->busy += machine.migration_cost;
+        begin += machine.migration_cost;
+        if (verbosity > 1)
+            event(begin, cpu, task->name, "has migrated");
+    }
+    a->cpu = cpu;
+    if (a->first_run < 0) {
+        a->first_run = begin;
+        if (verbosity > 1)
+            event(begin, cpu, task->name, "runs for the first time");
+    }
+
+    p->free_at = a->ready = begin + slice;
+    p->busy += slice;
+    if (p->free_at > finish)
+        finish = p->free_at;
+
+    // so that their arrivals are logged in order, before it completes
+    if (single) {
+        now = p->free_at;
+        deliver();
+    }
+
+    if ((a->remaining -= slice) <= 0 && a->completion < 0) {
+        a->completion = p->free_at;
+        completed++;
+        if (verbosity > 1)
+            event(p->free_at, cpu, task->name, "completes");
+    }
+}
+
+void run_on(int cpu, Task *task, int slice) {
+    execute(cpu, task, slice, 0);
+}
+
+// the CPU that is free first, with the clock moved on to that time
+int next_cpu(void) {
+    int c, first;
+
+    for (;;) {
+        first = 0;
+        for (c = 1; c < machine.cpus; c++) {
+            if (cpus[c].free_at < cpus[first].free_at)
+                first = c;
+        }
+
+        // tasks that arrive before then may wake an idle CPU
+        if (arrived == trace->count || (long) nth(arrived)->arrival > cpus[first].free_at)
+            break;
+        now = nth(arrived)->arrival;
+        deliver();
+    }
+    if (cpus[first].free_at == LONG_MAX)
+        return -1;
+
+    now = cpus[first].free_at;
+    cpus[first].parked = 0;
+
+    return first;
+}
+
+// a CPU with nothing to run idles until it is woken
+void idle_on(int cpu) {
+    cpus[cpu].parked = 1;
+    cpus[cpu].free_at = LONG_MAX;
+}
+
+// an idle CPU looks again now
+void wake(int cpu) {
+    if (cpus[cpu].parked && cpus[cpu].free_at > now)
+        cpus[cpu].free_at = now;
+}
+
+// a scheduler that uses run() and idle() only knows of CPU 0, so
+// it must not pass for a run on more
+static void single_cpu(void) {
+    if (machine.cpus > 1) {
+        fprintf(stderr, "cpu: this scheduler runs on one CPU; -c is for smp\n");
+        exit(1);
+    }
+}
+
+// run this task on CPU 0 for the specified time slice
 void run(Task *task, int slice) {
-    printf("Running task = [%s] [%d] [%d] for %d units.\n",task->name, task->priority, task->burst, slice);
+    single_cpu();
+    execute(0, task, slice, 1);
+}
+
+// idle CPU 0 until the next task arrives
+int idle(void) {
+    single_cpu();
+    if (arrived == trace->count)
+        return 0;
+
+    if (verbosity > 1)
+        printf("%10ld: idle\n", now);
+    now = cpus[0].free_at = nth(arrived)->arrival;
+    deliver();
+
+    return 1;
+}
+
+// report the metrics of each task and the averages
+void report(void) {
+    double turnaround = 0, waiting = 0, response = 0;
+    long busy = 0, switches = 0, migrations = 0;
+    size_t i;
+    int c;
+
+    if (verbosity > 0)
+        printf("\n%-16s %10s %10s %10s %10s %10s\n",
+            "task", "arrival", "burst", "turnaround", "waiting", "response");
+
+    for (i = 0; i < arrived; i++) {
+        struct account *a = &accounts[i];
+
+        if (a->completion < 0)
+            continue;
+
+        turnaround += a->completion - a->arrival;
+        waiting += a->completion - a->arrival - a->burst;
+        response += a->first_run - a->arrival;
+
+        if (verbosity > 0)
+            printf("%-16s %10ld %10ld %10ld %10ld %10ld\n", trace->names + nth(i)->name,
+                a->arrival, a->burst, a->completion - a->arrival,
+                a->completion - a->arrival - a->burst, a->first_run - a->arrival);
+    }
+
+    for (c = 0; c < machine.cpus; c++) {
+        busy += cpus[c].busy;
+        switches += cpus[c].switches;
+        migrations += cpus[c].migrations;
+    }
+
+    if (machine.cpus > 1) {
+        printf("\n%-4s %12s %12s %12s %12s\n", "cpu", "busy", "utilization", "switches", "migrations");
+        for (c = 0; c < machine.cpus; c++)
+            printf("%-4d %12ld %11.1f%% %12ld %12ld\n", c, cpus[c].busy,
+                finish > 0 ? 100.0 * cpus[c].busy / finish : 0.0,
+                cpus[c].switches, cpus[c].migrations);
+    }
+
+    printf("\n%zu tasks completed in %ld units with %ld context switches\n", completed, finish, switches);
+    if (machine.cpus > 1)
+        printf("%ld migrations costing %ld units\n", migrations, migrations * machine.migration_cost);
+    if (completed > 0 && finish > 0) {
+        printf("average turnaround %.2f, waiting %.2f, response %.2f\n",
+            turnaround / completed, waiting / completed, response / completed);
+        printf("throughput %.4f tasks per unit, CPU utilization %.1f%%\n",
+            (double) completed / finish, 100.0 * busy / ((double) finish * machine.cpus));
+    }
+    if (completed < trace->count)
+        fprintf(stderr, "%zu tasks were not completed\n", trace->count - completed);
+
+    free(accounts);
+    free(cpus);
+    free(order);
+    accounts = NULL;
+    cpus = NULL;
+    order = NULL;
 }
@@ -1,5 +1,53 @@
 // length of a time quantum
 #define QUANTUM 10
 
+// the most CPUs a machine can have
+#define MAX_CPUS 256
+
+// how an SMP scheduler balances its per-CPU run queues
+#define BALANCE_PUSH 1          // a task that arrives goes to the least loaded CPU
+#define BALANCE_PULL 2          // a CPU with nothing to run takes from the busiest
+#define BALANCE_PERIODIC 4      // the run queues are evened out every interval
+
+struct trace;
+
+// the simulated machine; set it before start()
+struct machine {
+    int cpus;
+    int migration_cost;     // time a task loses when it runs on another CPU than last time
+    int balance;            // BALANCE_* flags
+    int balance_interval;   // time between periodic rebalances
+};
+
+extern struct machine machine;
+
 // run the specified task for the following time slice
 void run(Task *task, int slice);
+
+// called by a scheduler that has nothing to run: let the clock run
+// to the next arrival and hand that task to add()
+// returns 0 if no task is still to come
+int idle(void);
+
+// the same for schedulers of more than one CPU: next_cpu() returns
+// the CPU that is free first, after the tasks that have arrived by
+// then went to add(), or -1 once every CPU is idle for good
+int next_cpu(void);
+void run_on(int cpu, Task *task, int slice);
+
+// a CPU with nothing to run idles until wake() has it look again
+// now, when there is something for it to do; add() has to wake the
+// CPU it gives an arriving task to
+void idle_on(int cpu);
+void wake(int cpu);
+
+// the time of the current event
+long current_time(void);
+
+// start the clock at 0 and hand the tasks of the trace to add() as
+// they arrive; verbosity 0 only reports the totals, 1 also every
+// slice and task, and 2 also every event
+void start(struct trace *trace, int verbosity);
+
+// report the metrics of each task, of each CPU and of the whole run
+void report(void);
@@ -3,47 +3,106 @@
  *
  * Schedule is in the format
  *
- *  [name] [priority] [CPU burst]
+ *  [name] [priority] [CPU burst] [arrival]
+ *
+ * where the arrival time may be left out, or the binary format of
+ * trace.h, which is told apart by its magic.
+ *
+ * usage: ./scheduler [-q | -v] [-c cpus] [-b balancing] [-i interval]
+ *                    [-m cost] schedule
+ *
+ *  -q  only report the totals
+ *  -v  also report every event
+ *  -c  the number of CPUs, for the schedulers of more than one
+ *  -b  how they balance their run queues: a comma-separated list of
+ *      push, pull and periodic
+ *  -i  the interval of periodic balancing
+ *  -m  the time a task loses when it migrates to another CPU
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "task.h"
 #include "list.h"
 #include "schedulers.h"
+#include "cpu.h"
+#include "trace.h"
+
+// the BALANCE_* flags of a list like "push,pull", or -1
+static int balancing(char *list)
+{
+    char *name;
+    int flags = 0;
+
+    for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (strcmp(name, "push") == 0)
+            flags |= BALANCE_PUSH;
+        else if (strcmp(name, "pull") == 0)
+            flags |= BALANCE_PULL;
+        else if (strcmp(name, "periodic") == 0)
+            flags |= BALANCE_PERIODIC;
+        else if (strcmp(name, "none") != 0)
+            return -1;
+    }
 
-#define SIZE    100
+    return flags;
+}
 
 int main(int argc, char *argv[])
 {
-    FILE *in;
-    char *temp;
-    char task[SIZE];
-
-    char *name;
-    int priority;
-    int burst;
+    struct trace trace;
+    int verbosity = 1;
+    int opt;
 
-    in = fopen(argv[1],"r");
-    
-    while (fgets(task,SIZE,in) != NULL) {
-        temp = strdup(task);
-        name = strsep(&temp,",");
-        priority = atoi(strsep(&temp,","));
-        burst = atoi(strsep(&temp,","));
+    while ((opt = getopt(argc, argv, "qvc:b:i:m:")) != -1) {
+        switch (opt) {
+        case 'q':
+            verbosity = 0;
+            break;
+        case 'v':
+            verbosity = 2;
+            break;
+        case 'c':
+            machine.cpus = atoi(optarg);
+            break;
+        case 'b':
+            machine.balance = balancing(optarg);
+            break;
+        case 'i':
+            machine.balance_interval = atoi(optarg);
+            break;
+        case 'm':
+            machine.migration_cost = atoi(optarg);
+            break;
+        default:
+            machine.cpus = 0;
+        }
+    }
 
-        // add the task to the scheduler's list of tasks
-        add(name,priority,burst);
+    if (optind != argc - 1 || machine.cpus < 1 || machine.cpus > MAX_CPUS ||
+        machine.balance < 0 || machine.balance_interval < 1 || machine.migration_cost < 0) {
+        fprintf(stderr, "usage: %s [-q | -v] [-c cpus <= %d] [-b push,pull,periodic] "
+            "[-i interval] [-m cost] schedule\n", argv[0], MAX_CPUS);
+        return 1;
+    }
 
-        free(temp);
+    if (trace_load(argv[optind], &trace) != 0) {
+        perror(argv[optind]);
+        return 1;
     }
 
-    fclose(in);
+    // the CPU hands the tasks to the scheduler as they arrive;
+    // the names stay in the trace until the end
+    start(&trace, verbosity);
 
     // invoke the scheduler
     schedule();
 
+    report();
+    trace_free(&trace);
+
     return 0;
 }
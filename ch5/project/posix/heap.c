@@ -0,0 +1,109 @@
+/**
+ * Indexed binary heap operations
+ *
+ * Every task in a heap knows its position in heap_index, so that a
+ * task can be deleted or moved after a key change without a search.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "heap.h"
+#include "task.h"
+
+// put a task at position i and tell it so
+static void place(struct heap *heap, int i, Task *task) {
+    heap->tasks[i] = task;
+    task->heap_index = i;
+}
+
+// move the task at position i up while it runs before its parent
+static void sift_up(struct heap *heap, int i) {
+    Task *task = heap->tasks[i];
+
+    while (i > 0 && heap->before(task, heap->tasks[(i - 1) / 2])) {
+        place(heap, i, heap->tasks[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(heap, i, task);
+}
+
+// move the task at position i down while a child runs before it
+static void sift_down(struct heap *heap, int i) {
+    Task *task = heap->tasks[i];
+    int child;
+
+    while ((child = 2 * i + 1) < heap->size) {
+        if (child + 1 < heap->size && heap->before(heap->tasks[child + 1], heap->tasks[child]))
+            child++;
+        if (! heap->before(heap->tasks[child], task))
+            break;
+        place(heap, i, heap->tasks[child]);
+        i = child;
+    }
+    place(heap, i, task);
+}
+
+// add a task to the heap
+void heap_insert(struct heap *heap, Task *task) {
+    if (heap->size == heap->capacity) {
+        int capacity = heap->capacity > 0 ? heap->capacity * 2 : 64;
+        Task **tasks = realloc(heap->tasks, sizeof(Task *) * capacity);
+
+        if (tasks == NULL) {
+            fprintf(stderr, "heap: out of memory\n");
+            exit(1);
+        }
+        heap->tasks = tasks;
+        heap->capacity = capacity;
+    }
+
+    place(heap, heap->size++, task);
+    sift_up(heap, heap->size - 1);
+}
+
+// the task that runs next, or NULL if the heap is empty
+Task *heap_peek(struct heap *heap) {
+    return heap->size > 0 ? heap->tasks[0] : NULL;
+}
+
+// remove and return the task that runs next, or NULL if the heap is empty
+Task *heap_pop(struct heap *heap) {
+    Task *task = heap_peek(heap);
+
+    if (task != NULL)
+        heap_delete(heap, task);
+
+    return task;
+}
+
+// remove a task from the heap
+void heap_delete(struct heap *heap, Task *task) {
+    int i = task->heap_index;
+    Task *last = heap->tasks[--heap->size];
+
+    task->heap_index = -1;
+    if (last == task)
+        return;
+
+    // the last task fills the hole and moves whichever way it has to
+    place(heap, i, last);
+    heap_update(heap, last);
+}
+
+// restore the order after the key of a task in the heap changed
+void heap_update(struct heap *heap, Task *task) {
+    int i = task->heap_index;
+
+    if (i > 0 && heap->before(task, heap->tasks[(i - 1) / 2]))
+        sift_up(heap, i);
+    else
+        sift_down(heap, i);
+}
+
+// free the heap's storage; the tasks are left alone
+void heap_destroy(struct heap *heap) {
+    free(heap->tasks);
+    heap->tasks = NULL;
+    heap->size = heap->capacity = 0;
+}
@@ -0,0 +1,30 @@
+/**
+ * Indexed binary heap of tasks, the ready queue of the priority
+ * and SJF schedulers.
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "task.h"
+
+struct heap {
+    Task **tasks;
+    int size;
+    int capacity;
+    // nonzero if a has to run before b; it must never call two
+    // different tasks equal, so that the order is stable
+    int (*before)(Task *a, Task *b);
+};
+
+#define HEAP_INITIALIZER(before) { NULL, 0, 0, before }
+
+// heap operations; each is O(log n) except heap_peek(), which is O(1)
+void heap_insert(struct heap *heap, Task *task);
+Task *heap_peek(struct heap *heap);
+Task *heap_pop(struct heap *heap);
+void heap_delete(struct heap *heap, Task *task);
+void heap_update(struct heap *heap, Task *task);
+void heap_destroy(struct heap *heap);
+
+#endif
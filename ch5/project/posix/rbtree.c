@@ -0,0 +1,256 @@
+/**
+ * Red-black tree operations
+ *
+ * The usual algorithms with NULL for the black leaves: every path
+ * from the root down to a leaf passes the same number of black
+ * tasks, and a red task has no red child, so no path is more than
+ * twice as long as another.
+ */
+
+#include <stdlib.h>
+
+#include "rbtree.h"
+#include "task.h"
+
+static int red(Task *task) {
+    return task != NULL && task->rb_red;
+}
+
+// make the parent of old point at new instead
+static void replace(struct rbtree *tree, Task *parent, Task *old, Task *new) {
+    if (parent == NULL)
+        tree->root = new;
+    else if (parent->rb_left == old)
+        parent->rb_left = new;
+    else
+        parent->rb_right = new;
+}
+
+// the right child of x takes its place, with x as its left child
+static void rotate_left(struct rbtree *tree, Task *x) {
+    Task *y = x->rb_right;
+
+    if ((x->rb_right = y->rb_left) != NULL)
+        y->rb_left->rb_parent = x;
+    y->rb_parent = x->rb_parent;
+    replace(tree, x->rb_parent, x, y);
+    y->rb_left = x;
+    x->rb_parent = y;
+}
+
+// the left child of x takes its place, with x as its right child
+static void rotate_right(struct rbtree *tree, Task *x) {
+    Task *y = x->rb_left;
+
+    if ((x->rb_left = y->rb_right) != NULL)
+        y->rb_right->rb_parent = x;
+    y->rb_parent = x->rb_parent;
+    replace(tree, x->rb_parent, x, y);
+    y->rb_right = x;
+    x->rb_parent = y;
+}
+
+// the task after this one in order, or NULL
+static Task *next(Task *task) {
+    Task *parent;
+
+    if (task->rb_right != NULL) {
+        for (task = task->rb_right; task->rb_left != NULL; task = task->rb_left)
+            ;
+        return task;
+    }
+    while ((parent = task->rb_parent) != NULL && task == parent->rb_right)
+        task = parent;
+    return parent;
+}
+
+// add a task to the tree
+void rbtree_insert(struct rbtree *tree, Task *task) {
+    Task *parent = NULL, **link = &tree->root;
+    Task *grandparent, *uncle;
+    int leftmost = 1;
+
+    while (*link != NULL) {
+        parent = *link;
+        if (tree->before(task, parent))
+            link = &parent->rb_left;
+        else {
+            link = &parent->rb_right;
+            leftmost = 0;
+        }
+    }
+
+    task->rb_parent = parent;
+    task->rb_left = task->rb_right = NULL;
+    task->rb_red = 1;
+    *link = task;
+    if (leftmost)
+        tree->first = task;
+    tree->size++;
+
+    // a red task with a red parent: recolor on the way up while the
+    // uncle is red, then one or two rotations end it
+    while (red(parent = task->rb_parent)) {
+        grandparent = parent->rb_parent;
+        if (parent == grandparent->rb_left) {
+            uncle = grandparent->rb_right;
+            if (red(uncle)) {
+                parent->rb_red = uncle->rb_red = 0;
+                grandparent->rb_red = 1;
+                task = grandparent;
+                continue;
+            }
+            if (task == parent->rb_right) {
+                rotate_left(tree, parent);
+                task = parent;
+                parent = task->rb_parent;
+            }
+            parent->rb_red = 0;
+            grandparent->rb_red = 1;
+            rotate_right(tree, grandparent);
+        } else {
+            uncle = grandparent->rb_left;
+            if (red(uncle)) {
+                parent->rb_red = uncle->rb_red = 0;
+                grandparent->rb_red = 1;
+                task = grandparent;
+                continue;
+            }
+            if (task == parent->rb_left) {
+                rotate_right(tree, parent);
+                task = parent;
+                parent = task->rb_parent;
+            }
+            parent->rb_red = 0;
+            grandparent->rb_red = 1;
+            rotate_left(tree, grandparent);
+        }
+    }
+    tree->root->rb_red = 0;
+}
+
+// the task that runs next, or NULL if the tree is empty
+Task *rbtree_first(struct rbtree *tree) {
+    return tree->first;
+}
+
+// remove and return the task that runs next, or NULL if the tree is empty
+Task *rbtree_pop(struct rbtree *tree) {
+    Task *task = tree->first;
+
+    if (task != NULL)
+        rbtree_delete(tree, task);
+
+    return task;
+}
+
+// restore the black heights after a black task was taken out above
+// child, which may be NULL and so needs its parent given
+static void rebalance(struct rbtree *tree, Task *child, Task *parent) {
+    Task *sibling;
+
+    while (child != tree->root && ! red(child)) {
+        if (child == parent->rb_left) {
+            sibling = parent->rb_right;
+            if (red(sibling)) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rotate_left(tree, parent);
+                sibling = parent->rb_right;
+            }
+            if (! red(sibling->rb_left) && ! red(sibling->rb_right)) {
+                sibling->rb_red = 1;
+                child = parent;
+                parent = child->rb_parent;
+                continue;
+            }
+            if (! red(sibling->rb_right)) {
+                sibling->rb_left->rb_red = 0;
+                sibling->rb_red = 1;
+                rotate_right(tree, sibling);
+                sibling = parent->rb_right;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = 0;
+            sibling->rb_right->rb_red = 0;
+            rotate_left(tree, parent);
+        } else {
+            sibling = parent->rb_left;
+            if (red(sibling)) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rotate_right(tree, parent);
+                sibling = parent->rb_left;
+            }
+            if (! red(sibling->rb_left) && ! red(sibling->rb_right)) {
+                sibling->rb_red = 1;
+                child = parent;
+                parent = child->rb_parent;
+                continue;
+            }
+            if (! red(sibling->rb_left)) {
+                sibling->rb_right->rb_red = 0;
+                sibling->rb_red = 1;
+                rotate_left(tree, sibling);
+                sibling = parent->rb_left;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = 0;
+            sibling->rb_left->rb_red = 0;
+            rotate_right(tree, parent);
+        }
+        child = tree->root;
+    }
+
+    if (child != NULL)
+        child->rb_red = 0;
+}
+
+// remove a task from the tree
+void rbtree_delete(struct rbtree *tree, Task *task) {
+    Task *child, *parent, *successor;
+    int was_red;
+
+    if (tree->first == task)
+        tree->first = next(task);
+
+    if (task->rb_left == NULL || task->rb_right == NULL) {
+        // a task with one child at most is replaced by it
+        child = task->rb_left != NULL ? task->rb_left : task->rb_right;
+        parent = task->rb_parent;
+        was_red = task->rb_red;
+        if (child != NULL)
+            child->rb_parent = parent;
+        replace(tree, parent, task, child);
+    } else {
+        // otherwise its successor, which has no left child, takes its
+        // place, and the successor's right child takes the successor's
+        for (successor = task->rb_right; successor->rb_left != NULL; successor = successor->rb_left)
+            ;
+        child = successor->rb_right;
+        was_red = successor->rb_red;
+
+        if (successor->rb_parent == task)
+            parent = successor;
+        else {
+            parent = successor->rb_parent;
+            if (child != NULL)
+                child->rb_parent = parent;
+            parent->rb_left = child;
+            successor->rb_right = task->rb_right;
+            task->rb_right->rb_parent = successor;
+        }
+
+        successor->rb_parent = task->rb_parent;
+        replace(tree, task->rb_parent, task, successor);
+        successor->rb_left = task->rb_left;
+        task->rb_left->rb_parent = successor;
+        successor->rb_red = task->rb_red;
+    }
+
+    task->rb_parent = task->rb_left = task->rb_right = NULL;
+    tree->size--;
+
+    if (! was_red)
+        rebalance(tree, child, parent);
+}
@@ -0,0 +1,30 @@
+/**
+ * Red-black tree of tasks, the ready queue of the CFS scheduler.
+ *
+ * The tree links the tasks themselves, so it never allocates, and it
+ * keeps its leftmost task at hand, the one that runs next.
+ */
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "task.h"
+
+struct rbtree {
+    Task *root;
+    Task *first;        // leftmost task
+    int size;
+    // nonzero if a has to run before b; it must never call two
+    // different tasks equal, so that the order is stable
+    int (*before)(Task *a, Task *b);
+};
+
+#define RBTREE_INITIALIZER(before) { NULL, NULL, 0, before }
+
+// tree operations; each is O(log n) except rbtree_first(), which is O(1)
+void rbtree_insert(struct rbtree *tree, Task *task);
+Task *rbtree_first(struct rbtree *tree);
+Task *rbtree_pop(struct rbtree *tree);
+void rbtree_delete(struct rbtree *tree, Task *task);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * O(1) run queue operations
+ */
+
+#include <stdlib.h>
+
+#include "runqueue.h"
+#include "schedulers.h"
+#include "task.h"
+
+_Static_assert(LEVELS <= 32, "one bit per priority level has to fit in the bitmap");
+
+// the level of a task, with priorities out of range clamped
+static int level(Task *task) {
+    if (task->priority > MAX_PRIORITY)
+        return 0;
+    if (task->priority < MIN_PRIORITY)
+        return LEVELS - 1;
+    return MAX_PRIORITY - task->priority;
+}
+
+// add a task to the back of its level
+void runqueue_add(struct runqueue *rq, Task *task) {
+    int i = level(task);
+
+    task->next = NULL;
+    if (rq->tail[i] != NULL)
+        rq->tail[i]->next = task;
+    else
+        rq->head[i] = task;
+    rq->tail[i] = task;
+
+    rq->bitmap |= 1u << i;
+}
+
+// remove and return the first task of the highest priority level
+// that is not empty, or NULL if there is none
+Task *runqueue_pick(struct runqueue *rq) {
+    Task *task;
+    int i;
+
+    if (rq->bitmap == 0)
+        return NULL;
+
+    i = __builtin_ctz(rq->bitmap);
+    task = rq->head[i];
+    if ((rq->head[i] = task->next) == NULL) {
+        rq->tail[i] = NULL;
+        rq->bitmap &= ~(1u << i);
+    }
+    task->next = NULL;
+
+    return task;
+}
+
+int runqueue_empty(struct runqueue *rq) {
+    return rq->bitmap == 0;
+}
@@ -0,0 +1,29 @@
+/**
+ * O(1) run queue: a FIFO of tasks per priority level and a bitmap
+ * of the levels that are not empty, as in the old O(1) scheduler
+ * of Linux.
+ */
+
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include "task.h"
+#include "schedulers.h"
+
+#define LEVELS (MAX_PRIORITY - MIN_PRIORITY + 1)
+
+struct runqueue {
+    // bit i is set if level i is not empty; level 0 holds MAX_PRIORITY
+    unsigned int bitmap;
+    Task *head[LEVELS];
+    Task *tail[LEVELS];
+};
+
+#define RUNQUEUE_INITIALIZER { 0 }
+
+// run queue operations, all O(1)
+void runqueue_add(struct runqueue *rq, Task *task);
+Task *runqueue_pick(struct runqueue *rq);
+int runqueue_empty(struct runqueue *rq);
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * Completely fair scheduling, after the CFS of Linux
+ *
+ * Every task has a weight from its priority, and its virtual runtime
+ * grows with the time it runs divided by its weight. The task with
+ * the least virtual runtime runs next, so over time each gets a share
+ * of the CPU in proportion to its weight.
+ *
+ * Rather than a fixed QUANTUM, the tasks that are ready share a
+ * period of TARGET_LATENCY by weight, and the period stretches so
+ * that no slice is shorter than MIN_GRANULARITY.
+ *
+ * The ready queue is a red-black tree ordered by virtual runtime,
+ * so inserting a task and picking the next are O(log n).
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "rbtree.h"
+#include "schedulers.h"
+
+// the 6 ms and 0.75 ms of Linux, in units of the simulation
+#define TARGET_LATENCY 48
+#define MIN_GRANULARITY 6
+
+// the weight of nice 0; virtual runtime counts in 1/NICE_0_WEIGHT units
+#define NICE_0_WEIGHT 1024
+
+// the weights of nice -20 to 19 in Linux, each about 1.25 times the next
+static const int nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+// less virtual runtime first; ties in arrival order
+static int fairer(Task *a, Task *b) {
+    if (a->vruntime != b->vruntime)
+        return a->vruntime < b->vruntime;
+    return a->tid < b->tid;
+}
+
+static struct rbtree ready = RBTREE_INITIALIZER(fairer);
+
+// tids are handed out in arrival order
+static int next_tid;
+
+// the total weight of the tasks that are ready or running
+static long load;
+
+// never more than the virtual runtime of any task that is ready or
+// running, and never decreasing; a new task starts there
+static long min_vruntime;
+
+// priorities MIN_PRIORITY to MAX_PRIORITY are nice 4 to -5
+static int weight(Task *task) {
+    int nice = 5 - task->priority;
+
+    if (nice < -20)
+        nice = -20;
+    if (nice > 19)
+        nice = 19;
+    return nice_to_weight[nice + 20];
+}
+
+// the slice of a task: its share of the period by weight
+static int slice_of(Task *task, int running) {
+    long period = TARGET_LATENCY;
+    long slice;
+
+    if (running > TARGET_LATENCY / MIN_GRANULARITY)
+        period = (long) running * MIN_GRANULARITY;
+
+    slice = period * weight(task) / load;
+    if (slice < MIN_GRANULARITY)
+        slice = MIN_GRANULARITY;
+    return slice < task->burst ? slice : task->burst;
+}
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+    task->vruntime = min_vruntime;
+
+    load += weight(task);
+    rbtree_insert(&ready, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task, *first;
+    int slice;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = rbtree_pop(&ready)) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+
+        slice = slice_of(task, ready.size + 1);
+
+        // charge the slice first, so that the tasks arriving while it
+        // runs start from an up to date min_vruntime
+        task->vruntime += (long) slice * NICE_0_WEIGHT * NICE_0_WEIGHT / weight(task);
+        first = rbtree_first(&ready);
+        if (first != NULL && first->vruntime < task->vruntime) {
+            if (first->vruntime > min_vruntime)
+                min_vruntime = first->vruntime;
+        } else if (task->vruntime > min_vruntime)
+            min_vruntime = task->vruntime;
+
+        run(task, slice);
+
+        if ((task->burst -= slice) > 0)
+            rbtree_insert(&ready, task);
+        else {
+            load -= weight(task);
+            free(task);
+        }
+    }
+}
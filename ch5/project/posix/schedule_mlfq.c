@@ -0,0 +1,129 @@
+/**
+ * Multilevel feedback queue scheduling
+ *
+ * Every task starts at the top level. The highest level that is not
+ * empty runs first, round-robin with the quantum of that level, and
+ * a task that uses up its whole quantum moves down a level, so short
+ * tasks finish near the top and long ones sink. Every MLFQ_BOOST
+ * units all tasks go back to the top, so that none starves.
+ *
+ * The levels and their quanta are MLFQ_QUANTA, top first, and may
+ * be set when building, e.g.
+ *
+ *  make mlfq CFLAGS='-Wall -DMLFQ_QUANTA="{5,10,20,40}" -DMLFQ_BOOST=1000'
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "schedulers.h"
+
+#ifndef MLFQ_QUANTA
+#define MLFQ_QUANTA { QUANTUM, 2 * QUANTUM, 4 * QUANTUM }
+#endif
+
+#ifndef MLFQ_BOOST
+#define MLFQ_BOOST (50 * QUANTUM)
+#endif
+
+static const int quanta[] = MLFQ_QUANTA;
+
+#define MLFQ_LEVELS ((int) (sizeof(quanta) / sizeof(quanta[0])))
+
+// a FIFO of tasks per level, linked through the tasks
+static Task *head[MLFQ_LEVELS], *tail[MLFQ_LEVELS];
+
+// tasks that completed at each level
+static long finished[MLFQ_LEVELS];
+
+// tids are handed out in arrival order
+static int next_tid;
+
+static long next_boost = MLFQ_BOOST;
+
+static void enqueue(int level, Task *task) {
+    task->next = NULL;
+    if (tail[level] != NULL)
+        tail[level]->next = task;
+    else
+        head[level] = task;
+    tail[level] = task;
+}
+
+// the first task of the highest level that is not empty, and its level
+static Task *dequeue(int *level) {
+    Task *task;
+    int i;
+
+    for (i = 0; i < MLFQ_LEVELS && head[i] == NULL; i++)
+        ;
+    if (i == MLFQ_LEVELS)
+        return NULL;
+
+    task = head[i];
+    if ((head[i] = task->next) == NULL)
+        tail[i] = NULL;
+    *level = i;
+
+    return task;
+}
+
+// move every level to the back of the top one, keeping their order
+static void boost(void) {
+    int i;
+
+    for (i = 1; i < MLFQ_LEVELS; i++) {
+        if (head[i] == NULL)
+            continue;
+        if (tail[0] != NULL)
+            tail[0]->next = head[i];
+        else
+            head[0] = head[i];
+        tail[0] = tail[i];
+        head[i] = tail[i] = NULL;
+    }
+}
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    enqueue(0, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+    int level, slice, i;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = dequeue(&level)) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+        slice = task->burst < quanta[level] ? task->burst : quanta[level];
+        run(task, slice);
+
+        if ((task->burst -= slice) > 0)
+            enqueue(level < MLFQ_LEVELS - 1 ? level + 1 : level, task);
+        else {
+            finished[level]++;
+            free(task);
+        }
+
+        if (current_time() >= next_boost) {
+            boost();
+            next_boost = current_time() - current_time() % MLFQ_BOOST + MLFQ_BOOST;
+        }
+    }
+
+    printf("\n%-6s %8s %12s\n", "level", "quantum", "completed");
+    for (i = 0; i < MLFQ_LEVELS; i++)
+        printf("%-6d %8d %12ld\n", i, quanta[i], finished[i]);
+}
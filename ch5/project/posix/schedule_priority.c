@@ -0,0 +1,45 @@
+/**
+ * Priority scheduling
+ *
+ * A higher number is a higher priority, from MIN_PRIORITY to
+ * MAX_PRIORITY. The ready queue is an O(1) run queue, so tasks of
+ * the same priority run in arrival order and each pick takes
+ * constant time.
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "runqueue.h"
+#include "schedulers.h"
+
+static struct runqueue ready = RUNQUEUE_INITIALIZER;
+
+// tids are handed out in arrival order
+static int next_tid;
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    runqueue_add(&ready, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = runqueue_pick(&ready)) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+        run(task, task->burst);
+        free(task);
+    }
+}
@@ -0,0 +1,50 @@
+/**
+ * Priority scheduling with round-robin
+ *
+ * The highest priority level runs first, and the tasks within a
+ * level take turns of at most QUANTUM: a task that is not done goes
+ * to the back of its level. Picking and requeueing are O(1).
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "runqueue.h"
+#include "schedulers.h"
+
+static struct runqueue ready = RUNQUEUE_INITIALIZER;
+
+// tids are handed out in arrival order
+static int next_tid;
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    runqueue_add(&ready, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+    int slice;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = runqueue_pick(&ready)) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+        slice = task->burst < QUANTUM ? task->burst : QUANTUM;
+        run(task, slice);
+
+        if ((task->burst -= slice) > 0)
+            runqueue_add(&ready, task);
+        else
+            free(task);
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * Round-robin scheduling
+ *
+ * The tasks take turns of at most QUANTUM in arrival order,
+ * whatever their priority: a task that is not done goes to the back
+ * of the ready queue.
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "schedulers.h"
+
+// the ready queue, linked through the tasks
+static Task *head, *tail;
+
+// tids are handed out in arrival order
+static int next_tid;
+
+static void enqueue(Task *task) {
+    task->next = NULL;
+    if (tail != NULL)
+        tail->next = task;
+    else
+        head = task;
+    tail = task;
+}
+
+static Task *dequeue(void) {
+    Task *task = head;
+
+    if (task != NULL && (head = task->next) == NULL)
+        tail = NULL;
+    return task;
+}
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    enqueue(task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+    int slice;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = dequeue()) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+        slice = task->burst < QUANTUM ? task->burst : QUANTUM;
+        run(task, slice);
+
+        if ((task->burst -= slice) > 0)
+            enqueue(task);
+        else
+            free(task);
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * Shortest-job-first scheduling
+ *
+ * The ready queue is a heap ordered by CPU burst, so each pick is
+ * O(log n) rather than a scan of every waiting task.
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "heap.h"
+#include "schedulers.h"
+
+// shorter burst first; tasks with the same burst in arrival order
+static int shorter(Task *a, Task *b) {
+    if (a->burst != b->burst)
+        return a->burst < b->burst;
+    return a->tid < b->tid;
+}
+
+static struct heap ready = HEAP_INITIALIZER(shorter);
+
+// tids are handed out in arrival order
+static int next_tid;
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    heap_insert(&ready, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+
+    // with nothing ready, the CPU idles until the next arrival
+    while ((task = heap_pop(&ready)) != NULL || idle()) {
+        if (task == NULL)
+            continue;
+        run(task, task->burst);
+        free(task);
+    }
+
+    heap_destroy(&ready);
+}
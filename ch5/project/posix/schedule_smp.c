@@ -0,0 +1,155 @@
+/**
+ * Priority scheduling with round-robin on more than one CPU
+ *
+ * Every CPU has an O(1) run queue of its own and schedules it like
+ * schedule_priority_rr.c. Tasks arrive on CPU 0; how they spread
+ * over the others is up to the balancing of machine.balance:
+ *
+ *  push      a task that arrives goes to the CPU with the least load
+ *  pull      a CPU with nothing to run takes a waiting task from the
+ *            CPU with the most
+ *  periodic  every balance_interval the loads are evened out
+ *
+ * The load of a CPU is the tasks in its run queue and the one it is
+ * running. A task that runs on another CPU than the last time costs
+ * the machine's migration_cost, which CPU.c charges and counts.
+ */
+
+#include <stdlib.h>
+
+#include "task.h"
+#include "cpu.h"
+#include "runqueue.h"
+#include "schedulers.h"
+
+static struct runqueue ready[MAX_CPUS];
+static int queued[MAX_CPUS];        // tasks in each run queue
+static Task *current[MAX_CPUS];     // task whose slice is running, if it is not done
+static int sleeping[MAX_CPUS];      // CPUs waiting for something to do
+
+// tids are handed out in arrival order
+static int next_tid;
+
+static long next_balance;
+
+static int load(int cpu) {
+    return queued[cpu] + (current[cpu] != NULL);
+}
+
+static void enqueue(int cpu, Task *task) {
+    int other;
+
+    runqueue_add(&ready[cpu], task);
+    queued[cpu]++;
+
+    if (sleeping[cpu]) {
+        sleeping[cpu] = 0;
+        wake(cpu);
+        return;
+    }
+
+    // the task has to wait, unless an idle CPU pulls it
+    if (machine.balance & BALANCE_PULL) {
+        for (other = 0; other < machine.cpus && !sleeping[other]; other++)
+            ;
+        if (other < machine.cpus) {
+            sleeping[other] = 0;
+            wake(other);
+        }
+    }
+}
+
+static Task *dequeue(int cpu) {
+    Task *task = runqueue_pick(&ready[cpu]);
+
+    if (task != NULL)
+        queued[cpu]--;
+    return task;
+}
+
+// the CPU with the most tasks waiting, and the one with the least load
+static int busiest(void) {
+    int cpu, found = 0;
+
+    for (cpu = 1; cpu < machine.cpus; cpu++) {
+        if (queued[cpu] > queued[found])
+            found = cpu;
+    }
+    return found;
+}
+
+static int idlest(void) {
+    int cpu, found = 0;
+
+    for (cpu = 1; cpu < machine.cpus; cpu++) {
+        if (load(cpu) < load(found))
+            found = cpu;
+    }
+    return found;
+}
+
+// move waiting tasks from the busiest to the idlest CPU until their
+// loads differ by one at most
+static void rebalance(void) {
+    int from, to;
+
+    for (;;) {
+        from = busiest();
+        to = idlest();
+        if (queued[from] == 0 || load(from) - load(to) <= 1)
+            break;
+        enqueue(to, dequeue(from));
+    }
+}
+
+// add a task to the list
+void add(char *name, int priority, int burst) {
+    Task *task = malloc(sizeof(Task));
+
+    task->name = name;
+    task->tid = next_tid++;
+    task->priority = priority;
+    task->burst = burst;
+
+    enqueue(machine.balance & BALANCE_PUSH ? idlest() : 0, task);
+}
+
+// invoke the scheduler
+void schedule() {
+    Task *task;
+    int cpu, slice;
+
+    next_balance = machine.balance_interval;
+
+    while ((cpu = next_cpu()) >= 0) {
+        // the task of the slice that has ended goes to the back of its level
+        if ((task = current[cpu]) != NULL) {
+            current[cpu] = NULL;
+            enqueue(cpu, task);
+        }
+
+        if ((machine.balance & BALANCE_PERIODIC) && current_time() >= next_balance) {
+            rebalance();
+            next_balance = current_time() - current_time() % machine.balance_interval
+                + machine.balance_interval;
+        }
+
+        if ((task = dequeue(cpu)) == NULL && (machine.balance & BALANCE_PULL))
+            task = dequeue(busiest());
+
+        // with nothing to run, the CPU idles until it is given a task
+        if (task == NULL) {
+            sleeping[cpu] = 1;
+            idle_on(cpu);
+            continue;
+        }
+
+        slice = task->burst < QUANTUM ? task->burst : QUANTUM;
+        run_on(cpu, task, slice);
+
+        if ((task->burst -= slice) > 0)
+            current[cpu] = task;
+        else
+            free(task);
+    }
+}
@@ -1,7 +1,8 @@
 #define MIN_PRIORITY 1
 #define MAX_PRIORITY 10
 
-// add a task to the list 
+// add a task to the list; the CPU calls it as each task arrives,
+// and it numbers the tasks 0, 1, 2, ... in that order (their tid)
 void add(char *name, int priority, int burst);
 
 // invoke the scheduler
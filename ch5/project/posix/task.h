@@ -11,6 +11,11 @@ typedef struct task {
     int tid;
     int priority;
     int burst;
+    int heap_index;     // position in a heap, see heap.h
+    struct task *next;  // next in a run queue level, see runqueue.h
+    struct task *rb_parent, *rb_left, *rb_right;    // see rbtree.h
+    int rb_red;
+    long vruntime;      // virtual runtime, see schedule_cfs.c
 } Task;
 
 #endif
@@ -0,0 +1,409 @@
+/**
+ * Schedule trace loader
+ *
+ * The schedule file is mapped. A text schedule is parsed in place,
+ * one line of
+ *
+ *  [name], [priority], [CPU burst], [arrival]
+ *
+ * at a time, where the arrival column may be left out; lines that
+ * do not have that form are reported and skipped, and blank lines
+ * are ignored. A binary schedule (see trace.h) is checked and then
+ * used where it is mapped.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+_Static_assert(sizeof(struct trace_record) == 16, "trace_record must match the binary record");
+
+// names are interned through an open-addressing table of arena
+// offsets plus one, 0 marking a free slot
+struct interner {
+    unsigned int *slots;
+    size_t mask;
+    size_t used;
+};
+
+// a growable array; failing to grow it ends the program, like the
+// schedulers do when they run out of memory
+static void *grow(void *p, size_t *capacity, size_t need, size_t size) {
+    size_t n = *capacity > 0 ? *capacity : 1024;
+
+    if (need <= *capacity)
+        return p;
+    while (n < need)
+        n *= 2;
+    if ((p = realloc(p, n * size)) == NULL) {
+        fprintf(stderr, "trace: out of memory\n");
+        exit(1);
+    }
+    *capacity = n;
+
+    return p;
+}
+
+static uint32_t hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+
+    while (n-- > 0)
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+
+    return h;
+}
+
+static void rehash(struct trace *trace, struct interner *in, size_t mask) {
+    unsigned int *slots = calloc(mask + 1, sizeof(unsigned int));
+    size_t i, j;
+
+    if (slots == NULL) {
+        fprintf(stderr, "trace: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; in->slots != NULL && i <= in->mask; i++) {
+        const char *name;
+
+        if (in->slots[i] == 0)
+            continue;
+        name = trace->names + in->slots[i] - 1;
+        for (j = hash(name, strlen(name)) & mask; slots[j] != 0; j = (j + 1) & mask)
+            ;
+        slots[j] = in->slots[i];
+    }
+
+    free(in->slots);
+    in->slots = slots;
+    in->mask = mask;
+}
+
+// the arena offset of the name s[0..n), added if it is new
+static unsigned int intern(struct trace *trace, struct interner *in, size_t *capacity,
+        const char *s, size_t n) {
+    size_t i;
+    unsigned int offset;
+
+    if (in->used * 2 >= in->mask + 1)
+        rehash(trace, in, in->mask * 2 + 1);
+
+    for (i = hash(s, n) & in->mask; in->slots[i] != 0; i = (i + 1) & in->mask) {
+        const char *name = trace->names + in->slots[i] - 1;
+
+        if (strncmp(name, s, n) == 0 && name[n] == '\0')
+            return in->slots[i] - 1;
+    }
+
+    if (trace->names_size + n + 1 > UINT_MAX) {
+        fprintf(stderr, "trace: too many names\n");
+        exit(1);
+    }
+
+    trace->names = grow(trace->names, capacity, trace->names_size + n + 1, 1);
+    offset = trace->names_size;
+    memcpy(trace->names + offset, s, n);
+    trace->names[offset + n] = '\0';
+    trace->names_size += n + 1;
+
+    in->slots[i] = offset + 1;
+    in->used++;
+
+    return offset;
+}
+
+static int blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// parse a number of at most max in magnitude at *p, stopping at end;
+// returns 0 if successful
+static int number(const char **p, const char *end, long long max, long long *value) {
+    const char *s = *p;
+    long long v = 0;
+    int negative = 0;
+
+    while (s < end && blank(*s))
+        s++;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    if (s == end || *s < '0' || *s > '9')
+        return -1;
+    for (; s < end && *s >= '0' && *s <= '9'; s++) {
+        v = v * 10 + (*s - '0');
+        if (v > max)
+            return -1;
+    }
+    while (s < end && blank(*s))
+        s++;
+
+    *value = negative ? -v : v;
+    *p = s;
+
+    return 0;
+}
+
+// parse one line into a record; returns 0 if successful
+static int parse(struct trace *trace, struct interner *in, size_t *names_capacity,
+        const char *s, const char *end, struct trace_record *record) {
+    const char *name, *name_end;
+    long long priority, burst, arrival;
+
+    while (s < end && blank(*s))
+        s++;
+    name = s;
+    while (s < end && *s != ',')
+        s++;
+    name_end = s;
+    while (name_end > name && blank(name_end[-1]))
+        name_end--;
+    if (s == end || name_end == name)
+        return -1;
+    s++;
+
+    if (number(&s, end, INT_MAX, &priority) != 0 || s == end || *s++ != ',')
+        return -1;
+    if (number(&s, end, INT_MAX, &burst) != 0 || burst <= 0)
+        return -1;
+
+    // the arrival is unsigned 32-bit, as in the binary format
+    arrival = 0;
+    if (s != end && (*s++ != ',' || number(&s, end, UINT32_MAX, &arrival) != 0 || arrival < 0))
+        return -1;
+    if (s != end)
+        return -1;
+
+    record->priority = priority;
+    record->burst = burst;
+    record->arrival = arrival;
+
+    record->name = intern(trace, in, names_capacity, name, name_end - name);
+
+    return 0;
+}
+
+// parse a text schedule
+static int load_text(const char *path, const char *map, size_t size, struct trace *trace) {
+    struct interner in = { NULL, 0, 0 };
+    size_t names_capacity = 0, line = 0;
+    const char *s, *end, *eol;
+    struct trace_record *records;
+
+    // no line is shorter than "a,1,1", so this many records always
+    // do; pages that are never written are never backed by memory
+    if ((trace->records = malloc((size / 6 + 1) * sizeof(struct trace_record))) == NULL)
+        return -1;
+    rehash(trace, &in, 1023);
+
+    for (s = map, end = map + size; s < end; s = eol + 1) {
+        const char *t;
+
+        line++;
+        if ((eol = memchr(s, '\n', end - s)) == NULL)
+            eol = end;
+
+        for (t = s; t < eol && blank(*t); t++)
+            ;
+        if (t == eol)
+            continue;
+
+        if (parse(trace, &in, &names_capacity, s, eol, &trace->records[trace->count]) == 0) {
+            trace->count++;
+        }
+        else {
+            fprintf(stderr, "%s:%zu: expected [name], [priority], [burst] and maybe [arrival]; line skipped\n",
+                path, line);
+            trace->skipped++;
+        }
+    }
+
+    free(in.slots);
+
+    // give back what was reserved for lines that were not there
+    if (trace->count > 0 && (records = realloc(trace->records, trace->count * sizeof(struct trace_record))) != NULL)
+        trace->records = records;
+
+    return 0;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p) {
+    return le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+// check a binary schedule and point the trace into it; returns 0 if
+// successful or -1 with errno set
+static int load_binary(const char *path, const unsigned char *map, size_t size, struct trace *trace) {
+    const unsigned char *r;
+    uint64_t count, names_size;
+    size_t i;
+
+    count = le64(map + 16);
+    names_size = le64(map + 24);
+    if (le32(map + 8) != TRACE_VERSION || le32(map + 12) != sizeof(struct trace_record) ||
+        names_size > UINT32_MAX || count > (size - TRACE_HEADER_SIZE) / sizeof(struct trace_record) ||
+        size - TRACE_HEADER_SIZE - count * sizeof(struct trace_record) != names_size ||
+        (names_size > 0 && map[size - 1] != '\0')) {
+        fprintf(stderr, "%s: damaged binary schedule\n", path);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // every name offset has to land in the string table, which ends
+    // with a NUL, so every name is a proper string
+    r = map + TRACE_HEADER_SIZE;
+    for (i = 0; i < count; i++, r += sizeof(struct trace_record)) {
+        if (le32(r) >= names_size || (int32_t) le32(r + 8) <= 0) {
+            fprintf(stderr, "%s: damaged record %zu\n", path, i);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    trace->count = count;
+    trace->names = (char *) map + TRACE_HEADER_SIZE + count * sizeof(struct trace_record);
+    trace->names_size = names_size;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    trace->records = (struct trace_record *) (map + TRACE_HEADER_SIZE);
+#else
+    if ((trace->records = malloc(count * sizeof(struct trace_record) + 1)) == NULL)
+        return -1;
+    for (i = 0, r = map + TRACE_HEADER_SIZE; i < count; i++, r += sizeof(struct trace_record)) {
+        trace->records[i].name = le32(r);
+        trace->records[i].priority = le32(r + 4);
+        trace->records[i].burst = le32(r + 8);
+        trace->records[i].arrival = le32(r + 12);
+    }
+#endif
+
+    return 0;
+}
+
+// load the schedule file at path, in either format
+int trace_load(const char *path, struct trace *trace) {
+    const char *map;
+    struct stat st;
+    int fd, rc;
+
+    memset(trace, 0, sizeof(*trace));
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+    if (st.st_size >= TRACE_HEADER_SIZE && memcmp(map, TRACE_MAGIC, 8) == 0) {
+        if ((rc = load_binary(path, (const unsigned char *) map, st.st_size, trace)) == 0) {
+            // the trace lives in the mapping until trace_free()
+            trace->map = (void *) map;
+            trace->map_size = st.st_size;
+            return 0;
+        }
+    }
+    else {
+        rc = load_text(path, map, st.st_size, trace);
+    }
+
+    munmap((void *) map, st.st_size);
+    if (rc != 0)
+        trace_free(trace);
+
+    return rc;
+}
+
+// write a trace as a text schedule
+int trace_write_text(const struct trace *trace, FILE *out) {
+    size_t i;
+
+    for (i = 0; i < trace->count; i++) {
+        const struct trace_record *r = &trace->records[i];
+
+        if (fprintf(out, "%s, %d, %d", trace->names + r->name, r->priority, r->burst) < 0)
+            return -1;
+        if (r->arrival != 0 && fprintf(out, ", %u", (unsigned int) r->arrival) < 0)
+            return -1;
+        if (fputc('\n', out) == EOF)
+            return -1;
+    }
+
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+// write a trace as a binary schedule
+int trace_write_binary(const struct trace *trace, FILE *out) {
+    unsigned char header[TRACE_HEADER_SIZE], record[sizeof(struct trace_record)];
+    size_t i;
+
+    memcpy(header, TRACE_MAGIC, 8);
+    put32(header + 8, TRACE_VERSION);
+    put32(header + 12, sizeof(struct trace_record));
+    put64(header + 16, trace->count);
+    put64(header + 24, trace->names_size);
+    if (fwrite(header, sizeof(header), 1, out) != 1)
+        return -1;
+
+    for (i = 0; i < trace->count; i++) {
+        const struct trace_record *r = &trace->records[i];
+
+        put32(record, r->name);
+        put32(record + 4, r->priority);
+        put32(record + 8, r->burst);
+        put32(record + 12, r->arrival);
+        if (fwrite(record, sizeof(record), 1, out) != 1)
+            return -1;
+    }
+
+    if (trace->names_size > 0 && fwrite(trace->names, trace->names_size, 1, out) != 1)
+        return -1;
+
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+void trace_free(struct trace *trace) {
+    if (trace->map != NULL) {
+#if !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        free(trace->records);
+#endif
+        munmap(trace->map, trace->map_size);
+    }
+    else {
+        free(trace->records);
+        free(trace->names);
+    }
+    memset(trace, 0, sizeof(*trace));
+}
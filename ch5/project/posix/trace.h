@@ -0,0 +1,62 @@
+/**
+ * Schedule traces loaded into memory in one pass.
+ *
+ * A trace is an array of records and one arena of names; each
+ * distinct name is stored once, and a record refers to it by its
+ * offset, so a trace costs a few words per task however long it is.
+ *
+ * A trace is stored either as text, one [name], [priority], [burst]
+ * line per task with an optional fourth [arrival] column, or in a
+ * binary format that is the same thing laid out for mmap. All its
+ * fields are little-endian:
+ *
+ *  header   "SCHEDTRC", u32 version (1), u32 record size (16),
+ *           u64 number of records, u64 size of the string table
+ *  records  u32 name offset, i32 priority, i32 burst, u32 arrival
+ *  strings  NUL-terminated names, ending with a NUL
+ *
+ * A task without an arrival time arrives at time 0.
+ *
+ * trace_load() tells the two apart by the magic at the start.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC "SCHEDTRC"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 32
+
+// the layout of a binary record, so that on a little-endian host
+// the records of a binary trace are used where they are mapped
+struct trace_record {
+    uint32_t name;          // offset of the name in the arena
+    int32_t priority;
+    int32_t burst;
+    uint32_t arrival;       // time the task arrives at
+};
+
+struct trace {
+    struct trace_record *records;
+    size_t count;
+    char *names;            // NUL-terminated names, back to back
+    size_t names_size;
+    size_t skipped;         // malformed lines that were left out
+    void *map;              // a binary trace used in place, or NULL
+    size_t map_size;
+};
+
+// returns 0 if successful or -1 with errno set if the file cannot be
+// read or, with EINVAL, is a damaged binary trace
+int trace_load(const char *path, struct trace *trace);
+void trace_free(struct trace *trace);
+
+// write a trace in either format; return 0 if successful or -1
+int trace_write_text(const struct trace *trace, FILE *out);
+int trace_write_binary(const struct trace *trace, FILE *out);
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * tracecvt.c
+ *
+ * Converts a schedule between the text and the binary format
+ * (see trace.h). The input may be in either format.
+ *
+ * usage: ./tracecvt [-b | -t] input output
+ *
+ *  -b  write a binary schedule (the default)
+ *  -t  write a text schedule
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+int main(int argc, char *argv[])
+{
+    struct trace trace;
+    int binary = 1, rc;
+    FILE *out;
+
+    if (argc == 4 && (strcmp(argv[1], "-b") == 0 || strcmp(argv[1], "-t") == 0)) {
+        binary = argv[1][1] == 'b';
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s [-b | -t] input output\n", argv[0]);
+        return 1;
+    }
+
+    if (trace_load(argv[1], &trace) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if ((out = fopen(argv[2], binary ? "wb" : "w")) == NULL) {
+        perror(argv[2]);
+        trace_free(&trace);
+        return 1;
+    }
+
+    rc = binary ? trace_write_binary(&trace, out) : trace_write_text(&trace, out);
+    if (fclose(out) != 0 || rc != 0) {
+        perror(argv[2]);
+        rc = 1;
+    }
+
+    trace_free(&trace);
+
+    return rc;
+}
@@ -0,0 +1,283 @@
+/**
+ * tracegen.c
+ *
+ * Generates a synthetic schedule of any size, in the text or the
+ * binary format (see trace.h). The same options and seed always give
+ * the same schedule.
+ *
+ * usage: ./tracegen [-b | -t] [-n tasks] [-s seed] [-a poisson | bursty]
+ *                   [-i interarrival] [-g group] [-d pareto | lognormal |
+ *                   exponential | fixed] [-m burst] [-k shape]
+ *                   [-p uniform | weights] output
+ *
+ *  -b  write a binary schedule (the default)
+ *  -t  write a text schedule
+ *  -n  the number of tasks (1000)
+ *  -s  the seed of the random numbers (1)
+ *  -a  how tasks arrive: a Poisson process, or bursts of tasks at ten
+ *      times the rate with quiet gaps between them (poisson)
+ *  -i  the mean time between arrivals, 0 for all at time 0 (10)
+ *  -g  the mean number of tasks in a burst (20)
+ *  -d  the distribution of CPU bursts (pareto)
+ *  -m  the mean CPU burst (8)
+ *  -k  the Pareto shape, above 1, or the lognormal sigma (2 or 1)
+ *  -p  the priorities: uniform, or comma-separated weights of
+ *      priority MIN_PRIORITY, MIN_PRIORITY + 1, ... (uniform)
+ *
+ * e.g. a million tasks with heavy-tailed bursts, arriving in bursts,
+ * mostly at low priority:
+ *
+ *  ./tracegen -n 1000000 -a bursty -d pareto -k 1.5 -p 8,4,2,1 big.bin
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "schedulers.h"
+#include "trace.h"
+
+// arrivals in a burst come this many times faster than on average
+#define BURST_SPEEDUP 10
+
+#define LEVELS (MAX_PRIORITY - MIN_PRIORITY + 1)
+
+enum arrivals { POISSON, BURSTY };
+enum bursts { PARETO, LOGNORMAL, EXPONENTIAL, FIXED };
+
+static uint64_t state;
+
+// splitmix64, so that a seed gives the same schedule everywhere
+static uint64_t next_random(void)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// uniform in (0, 1]
+static double uniform(void)
+{
+    return ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double exponential(double mean)
+{
+    return -mean * log(uniform());
+}
+
+static double normal(void)
+{
+    return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+// a CPU burst with the given mean, at least 1
+static int32_t burst(enum bursts d, double mean, double shape)
+{
+    double x;
+
+    switch (d) {
+    case PARETO:
+        // the scale that gives this mean with this shape
+        x = mean * (shape - 1) / shape / pow(uniform(), 1 / shape);
+        break;
+    case LOGNORMAL:
+        x = exp(log(mean) - shape * shape / 2 + shape * normal());
+        break;
+    case EXPONENTIAL:
+        x = exponential(mean);
+        break;
+    default:
+        x = mean;
+    }
+
+    if (x < 1)
+        return 1;
+    if (x >= INT32_MAX)
+        return INT32_MAX;
+    return (int32_t) (x + 0.5);
+}
+
+// the cumulative weights of a list like "8,4,2,1", or 0 if it is wrong
+static int priorities(char *list, double cumulative[LEVELS])
+{
+    char *weight, *end;
+    double total = 0;
+    int i, n = 0;
+
+    if (strcmp(list, "uniform") == 0) {
+        for (i = 0; i < LEVELS; i++)
+            cumulative[i] = i + 1;
+        return 1;
+    }
+
+    for (weight = strtok(list, ","); weight != NULL; weight = strtok(NULL, ",")) {
+        double w = strtod(weight, &end);
+
+        if (n == LEVELS || *end != '\0' || end == weight || w < 0)
+            return 0;
+        cumulative[n++] = total += w;
+    }
+    for (i = n; i < LEVELS; i++)
+        cumulative[i] = total;
+
+    return total > 0;
+}
+
+static int priority(const double cumulative[LEVELS])
+{
+    double x = uniform() * cumulative[LEVELS - 1];
+    int i;
+
+    for (i = 0; i < LEVELS - 1 && x > cumulative[i]; i++)
+        ;
+    return MIN_PRIORITY + i;
+}
+
+int main(int argc, char *argv[])
+{
+    struct trace trace;
+    enum arrivals arrivals = POISSON;
+    enum bursts bursts = PARETO;
+    double interarrival = 10, group = 20, mean = 8, shape = 0;
+    double cumulative[LEVELS];
+    double now = 0;
+    long long count = 1000;
+    long left = 0;
+    int binary = 1, ok = 1, opt, rc;
+    size_t i;
+    FILE *out;
+
+    state = 1;
+    priorities("uniform", cumulative);
+
+    while ((opt = getopt(argc, argv, "btn:s:a:i:g:d:m:k:p:")) != -1) {
+        switch (opt) {
+        case 'b':
+        case 't':
+            binary = opt == 'b';
+            break;
+        case 'n':
+            count = atoll(optarg);
+            break;
+        case 's':
+            state = strtoull(optarg, NULL, 0);
+            break;
+        case 'a':
+            if (strcmp(optarg, "poisson") == 0)
+                arrivals = POISSON;
+            else if (strcmp(optarg, "bursty") == 0)
+                arrivals = BURSTY;
+            else
+                ok = 0;
+            break;
+        case 'i':
+            interarrival = atof(optarg);
+            break;
+        case 'g':
+            group = atof(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "pareto") == 0)
+                bursts = PARETO;
+            else if (strcmp(optarg, "lognormal") == 0)
+                bursts = LOGNORMAL;
+            else if (strcmp(optarg, "exponential") == 0)
+                bursts = EXPONENTIAL;
+            else if (strcmp(optarg, "fixed") == 0)
+                bursts = FIXED;
+            else
+                ok = 0;
+            break;
+        case 'm':
+            mean = atof(optarg);
+            break;
+        case 'k':
+            shape = atof(optarg);
+            break;
+        case 'p':
+            ok &= priorities(optarg, cumulative);
+            break;
+        default:
+            ok = 0;
+        }
+    }
+
+    if (shape == 0)
+        shape = bursts == PARETO ? 2 : 1;
+
+    if (! ok || optind != argc - 1 || count < 0 || (unsigned long long) count > UINT32_MAX / 12 ||
+        interarrival < 0 || group < 1 || mean < 1 || shape <= 0 || (bursts == PARETO && shape <= 1)) {
+        fprintf(stderr, "usage: %s [-b | -t] [-n tasks] [-s seed] [-a poisson | bursty] "
+            "[-i interarrival] [-g group] [-d pareto | lognormal | exponential | fixed] "
+            "[-m burst] [-k shape] [-p uniform | weights] output\n", argv[0]);
+        return 1;
+    }
+
+    memset(&trace, 0, sizeof(trace));
+    trace.count = count;
+    trace.records = malloc(sizeof(struct trace_record) * (count + 1));
+    // "T" and up to ten digits for each name
+    trace.names = malloc(12 * (count + 1));
+    if (trace.records == NULL || trace.names == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        trace_free(&trace);
+        return 1;
+    }
+
+    for (i = 0; i < trace.count; i++) {
+        struct trace_record *r = &trace.records[i];
+
+        if (arrivals == POISSON) {
+            if (i > 0)
+                now += exponential(interarrival);
+        }
+        else if (left > 0) {
+            now += exponential(interarrival / BURST_SPEEDUP);
+            left--;
+        }
+        else {
+            // the quiet gap keeps the mean time between arrivals
+            if (i > 0)
+                now += exponential(group * interarrival - (group - 1) * interarrival / BURST_SPEEDUP);
+
+            // a new burst, of a geometric number of tasks with the mean of group
+            left = group > 1 ? (long) floor(log(uniform()) / log(1 - 1 / group)) : 0;
+        }
+
+        if (now > UINT32_MAX) {
+            fprintf(stderr, "%s: arrival times run past %u; use fewer tasks or a shorter -i\n",
+                argv[0], UINT32_MAX);
+            trace_free(&trace);
+            return 1;
+        }
+
+        r->name = trace.names_size;
+        r->priority = priority(cumulative);
+        r->burst = burst(bursts, mean, shape);
+        r->arrival = (uint32_t) now;
+        trace.names_size += sprintf(trace.names + trace.names_size, "T%zu", i + 1) + 1;
+    }
+
+    if ((out = fopen(argv[optind], binary ? "wb" : "w")) == NULL) {
+        perror(argv[optind]);
+        trace_free(&trace);
+        return 1;
+    }
+
+    rc = binary ? trace_write_binary(&trace, out) : trace_write_text(&trace, out);
+    if (fclose(out) != 0 || rc != 0) {
+        perror(argv[optind]);
+        rc = 1;
+    }
+
+    trace_free(&trace);
+
+    return rc;
+}
@@ -0,0 +1,213 @@
+/**
+ * Benchmark for the thread pool.
+ *
+ * For every combination of producers, workers and task size it
+ * reports submit throughput, the throughput of the whole run and the
+ * submit-to-start latency percentiles as one CSV line, so runs can be
+ * compared with diff or a spreadsheet.
+ *
+ * submits_per_sec counts from the start to when the last producer is
+ * done submitting; tasks_per_sec counts to when the last task is done,
+ * so for the larger tasks it mostly measures task_ns * tasks / workers.
+ *
+ * usage: ./bench [tasks] [max producers] [max workers]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "threadpool.h"
+
+#define DEFAULT_TASKS 200000
+#define DEFAULT_PRODUCERS 4
+#define DEFAULT_WORKERS 4
+#define MAX_PRODUCERS 64
+
+// each configuration runs at most this much task time in total,
+// so the 100us tasks do not take minutes
+#define WORK_BUDGET_NS 2000000000ULL
+
+// how long each task computes for
+static const uint64_t task_sizes[] = { 0, 1000, 10000, 100000 };
+
+// one submitted task
+struct sample
+{
+    uint64_t submitted;
+    uint64_t started;
+    uint64_t work_ns;
+};
+
+struct run
+{
+    struct sample *samples;
+    int tasks;
+    int producers;
+    pthread_barrier_t start;
+    atomic_int done;
+    atomic_ullong submitted;    // when the last producer was done submitting
+    atomic_ullong finished;
+    atomic_ullong retries;
+};
+
+static struct run current_run;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the task: note when it started, then compute for work_ns
+void work(void *param)
+{
+    struct sample *s = param;
+    uint64_t start = now_ns();
+
+    s->started = start;
+    while (s->work_ns > 0 && now_ns() - start < s->work_ns)
+        ;
+
+    if (atomic_fetch_add(&current_run.done, 1) + 1 == current_run.tasks)
+        atomic_store(&current_run.finished, now_ns());
+}
+
+void *producer(void *param)
+{
+    long id = (long) param;
+    struct run *r = &current_run;
+    uint64_t end, last;
+    int i;
+
+    pthread_barrier_wait(&r->start);
+
+    // producers take interleaved samples
+    for (i = id; i < r->tasks; i += r->producers) {
+        struct sample *s = &r->samples[i];
+
+        s->submitted = now_ns();
+        while (pool_submit(&work, s) != 0) {
+            atomic_fetch_add_explicit(&r->retries, 1, memory_order_relaxed);
+            sched_yield();
+        }
+    }
+
+    end = now_ns();
+    last = atomic_load(&r->submitted);
+    while (end > last && ! atomic_compare_exchange_weak(&r->submitted, &last, end))
+        ;
+
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// 1, 2, 4, ... and finally max itself
+static int next_step(int x, int max)
+{
+    return x < max && x * 2 > max ? max : x * 2;
+}
+
+static void run_one(int producers, int workers, uint64_t work_ns, int tasks)
+{
+    struct run *r = &current_run;
+    pthread_t threads[MAX_PRODUCERS];
+    uint64_t *latency, begin, submitting, elapsed;
+    int i;
+
+    r->samples = malloc(sizeof(struct sample) * tasks);
+    latency = malloc(sizeof(uint64_t) * tasks);
+    if (r->samples == NULL || latency == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < tasks; i++)
+        r->samples[i].work_ns = work_ns;
+    r->tasks = tasks;
+    r->producers = producers;
+    atomic_init(&r->done, 0);
+    atomic_init(&r->submitted, 0);
+    atomic_init(&r->finished, 0);
+    atomic_init(&r->retries, 0);
+    pthread_barrier_init(&r->start, NULL, producers + 1);
+
+    // a fixed-size pool of the wanted width, the path pool_init() takes
+    pool_init_fixed(workers);
+
+    for (i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, (void *) (long) i);
+
+    begin = now_ns();
+    pthread_barrier_wait(&r->start);
+
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+
+    pool_shutdown();
+    submitting = atomic_load(&r->submitted) - begin;
+    elapsed = atomic_load(&r->finished) - begin;
+
+    for (i = 0; i < tasks; i++)
+        latency[i] = r->samples[i].started - r->samples[i].submitted;
+    qsort(latency, tasks, sizeof(uint64_t), compare_u64);
+
+    printf("%d,%d,%llu,%d,%.6f,%.0f,%.6f,%.0f,%llu,%llu,%llu,%llu\n",
+        producers, workers, (unsigned long long) work_ns, tasks,
+        submitting / 1e9, tasks / (submitting / 1e9),
+        elapsed / 1e9, tasks / (elapsed / 1e9),
+        (unsigned long long) latency[tasks / 2],
+        (unsigned long long) latency[(int) (tasks * 0.99)],
+        (unsigned long long) latency[(int) (tasks * 0.999)],
+        (unsigned long long) atomic_load(&r->retries));
+    fflush(stdout);
+
+    pthread_barrier_destroy(&r->start);
+    free(latency);
+    free(r->samples);
+}
+
+int main(int argc, char *argv[])
+{
+    int tasks = argc > 1 ? atoi(argv[1]) : DEFAULT_TASKS;
+    int max_producers = argc > 2 ? atoi(argv[2]) : DEFAULT_PRODUCERS;
+    int max_workers = argc > 3 ? atoi(argv[3]) : DEFAULT_WORKERS;
+    int producers, workers;
+    size_t size;
+
+    if (tasks < 1 || max_producers < 1 || max_producers > MAX_PRODUCERS ||
+        max_workers < 1 || max_workers > POOL_MAX_THREADS) {
+        fprintf(stderr, "usage: %s [tasks] [max producers <= %d] [max workers <= %d]\n",
+            argv[0], MAX_PRODUCERS, POOL_MAX_THREADS);
+        return 1;
+    }
+
+    printf("producers,workers,task_ns,tasks,submit_seconds,submits_per_sec,"
+        "seconds,tasks_per_sec,p50_ns,p99_ns,p999_ns,full_retries\n");
+
+    for (size = 0; size < sizeof(task_sizes) / sizeof(task_sizes[0]); size++) {
+        uint64_t work_ns = task_sizes[size];
+        int n = tasks;
+
+        if (work_ns > 0 && (uint64_t) n * work_ns > WORK_BUDGET_NS)
+            n = WORK_BUDGET_NS / work_ns;
+
+        for (workers = 1; workers <= max_workers; workers = next_step(workers, max_workers)) {
+            for (producers = 1; producers <= max_producers; producers = next_step(producers, max_producers))
+                run_one(producers, workers, work_ns, n);
+        }
+    }
+
+    return 0;
+}
@@ -3,9 +3,11 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
 #include "threadpool.h"
 
+#define BATCH_SIZE 5
+#define RANGE 1000
+
 struct data
 {
     int a;
@@ -20,6 +22,20 @@ void add(void *param)
     printf("I add two values %d and %d result = %d\n",temp->a, temp->b, temp->a + temp->b);
 }
 
+// add up the integers in [lo, hi) into *acc
+void sum_range(long lo, long hi, void *acc, void *ctx)
+{
+    long *total = acc;
+
+    for (; lo < hi; lo++)
+        *total += lo;
+}
+
+void combine_sums(void *acc, const void *other, void *ctx)
+{
+    *(long *) acc += *(const long *) other;
+}
+
 int main(void)
 {
     // create some work to do
@@ -27,14 +43,45 @@ int main(void)
     work.a = 5;
     work.b = 10;
 
+    struct data more[BATCH_SIZE];
+    void *args[BATCH_SIZE];
+    pool_future *f;
+    long total = 0;
+    int i;
+
+    for (i = 0; i < BATCH_SIZE; i++) {
+        more[i].a = i;
+        more[i].b = i * i;
+        args[i] = &more[i];
+    }
+
     // initialize the thread pool
     pool_init();
 
-    // submit the work to the queue
-    pool_submit(&add,&work);
+    // submit the work to the queue and wait for it
+    f = pool_submit_future(&add,&work);
+    if (f != NULL) {
+        pool_future_wait(f);
+        pool_future_release(f);
+    }
+
+    // submit work by value; the pool keeps its own copy
+    for (i = 0; i < BATCH_SIZE; i++) {
+        struct data copy = { i, 100 * i };
+
+        pool_submit_copy(&add, &copy, sizeof(copy));
+    }
+
+    // submit a batch of work and wait for all of it
+    f = pool_submit_batch(&add,args,BATCH_SIZE);
+    if (f != NULL) {
+        pool_future_wait(f);
+        pool_future_release(f);
+    }
 
-    // may be helpful 
-    //sleep(3);
+    // add up a range without chunking it by hand
+    pool_parallel_reduce(0, RANGE, 100, &sum_range, &combine_sums, &total, sizeof(total), NULL);
+    printf("The integers below %d add up to %ld\n", RANGE, total);
 
     pool_shutdown();
 
@@ -2,81 +2,2932 @@
  * Implementation of thread pool.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <semaphore.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
 #include "threadpool.h"
 
-#define QUEUE_SIZE 10
+// QUEUE_SIZE and DEQUE_SIZE must be powers of two so a position maps to a slot with a mask
+#define QUEUE_SIZE 1024
+#define DEQUE_SIZE 1024
 #define NUMBER_OF_THREADS 3
 
+// a producer samples the depth of a work queue for its high water
+// mark once every HIGH_WATER_SAMPLE positions, so that it seldom
+// reads the head, which is the workers' cache line
+#define HIGH_WATER_SAMPLE 16
+#define MAX_THREADS POOL_MAX_THREADS
+
+// every STARVATION_LIMIT-th pick of a worker looks at the
+// lowest priority lane first
+#define STARVATION_LIMIT 16
+
+// task nodes are carved out of slabs of this many nodes
+#define NODES_PER_SLAB 64
+
+#define CACHE_LINE 64
+
+// usable stack of a fiber; a guard page below it catches overflows
+#define FIBER_STACK_SIZE (64 * 1024)
+
+// a worker that runs dry polls the queues between SPIN_MIN and
+// SPIN_MAX times before it parks; the count doubles when polling
+// found work and halves when it did not
+#define SPIN_MIN 4
+#define SPIN_MAX 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+// the timing wheel has TIMER_LEVELS levels of TIMER_SLOTS slots;
+// a slot of level 0 is one tick, one of level n spans TIMER_SLOTS^n
+// ticks, so the wheel reaches TIMER_SLOTS^TIMER_LEVELS ticks ahead
+#define TIMER_TICK_NS 1000000
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
 #define TRUE 1
 
-// this represents work that has to be 
+struct node_cache;
+
+// this represents work that has to be
 // completed by a thread in the pool
-typedef struct 
+typedef struct task
 {
     void (*function)(void *p);
     void *data;
+    pool_future *future;
+    uint64_t submitted;     // CLOCK_MONOTONIC ns at submit
+    int priority;           // the lane, POOL_PRIORITY_HIGH first
+    int heap_arg;           // data is a malloc()ed copy to free after running
+    int completion;         // goes to the completion channel after running
+    struct node_cache *owner;
+    struct task *next;      // free list link
+    _Alignas(16) char arg[POOL_INLINE_ARG];
 }
 task;
 
-// the work queue
-task worktodo;
+// a thread's supply of free task nodes. Only the owning thread
+// takes nodes; other threads hand nodes back through remote.
+typedef struct node_cache
+{
+    task *free;
+    _Alignas(CACHE_LINE) _Atomic(task *) remote;
+    struct node_cache *next_orphan;
+}
+node_cache;
+
+// the calling thread's node cache
+static __thread node_cache *my_cache;
+
+// caches of threads that have exited, waiting to be adopted;
+// caches and slabs are never returned to malloc, they are reused
+// by later threads and later pools
+static node_cache *orphans;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+struct fiber;
+
+// a dependency: succ, or a suspended fiber, waits for the future
+// whose list this is on
+typedef struct edge
+{
+    pool_future *succ;
+    struct fiber *fiber;
+    struct edge *next;
+}
+edge;
+
+// completion handle shared by the caller and the pool
+struct pool_future
+{
+    atomic_int pending;     // tasks that still have to run
+    atomic_int refs;        // the caller's handle plus one for the pool
+    sem_t done;             // posted once pending reaches zero
+    _Atomic(edge *) successors; // futures waiting on this one, CLOSED once complete
+    atomic_int waiting;     // of a graph task: unfinished dependencies, plus one until submitted
+    task *deferred;         // of a graph task: queued once waiting reaches zero
+};
+
+// ends the successor list of a future that has completed
+static edge successors_closed;
+#define CLOSED (&successors_closed)
+
+// a batch of tasks that share one function and one future;
+// the runners submitted for it claim items one at a time
+typedef struct
+{
+    void (*function)(void *p);
+    void **data;
+    int n;
+    atomic_int next;
+    atomic_int refs;        // one per runner
+    pool_future *future;
+}
+batch;
+
+// a task with its own stack, which can suspend and later resume on
+// any worker
+typedef struct fiber
+{
+    ucontext_t ctx;
+    ucontext_t *caller;         // where to switch back to when it suspends
+    void (*function)(void *p);
+    void *data;
+    char *stack;                // the mapping, guard page first
+    int started;
+    int done;
+    void (*park)(struct fiber *f, void *arg);   // run once it has switched out
+    void *park_arg;
+    struct fiber *next;         // wait list link
+}
+fiber;
+
+// a fiber waits on a pool_event or pool_mutex in a list; threads
+// that are not fibers wait on the condition variable
+struct pool_event
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int set;
+    fiber *waiters;
+};
+
+struct pool_mutex
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int locked;
+    int blocked_threads;
+    fiber *head;                // waiting fibers, first come first served
+    fiber *tail;
+};
+
+// the fiber the calling thread is running, or NULL
+static __thread fiber *this_fiber;
+
+// a parallel loop shared by the calling thread and its helpers
+typedef struct
+{
+    long end;
+    long grain;
+    int participants;       // the caller plus its helpers
+    atomic_long next;       // first index not yet claimed
+    atomic_long remaining;  // indices not yet finished
+    atomic_int slots;       // accumulators handed out, the caller has 0
+    atomic_int refs;        // the caller plus one per queued helper
+    sem_t done;             // posted when remaining reaches zero
+    void (*body)(long begin, long end, void *ctx);
+    void (*reduce)(long begin, long end, void *acc, void *ctx);
+    void *ctx;
+    size_t stride;          // bytes per accumulator, a cache line multiple
+    char acc[];
+}
+loop;
+
+// one slot of the work queue; seq tells whose turn it is:
+// seq == pos means free for the producer of pos,
+// seq == pos + 1 means filled for the consumer of pos
+typedef struct
+{
+    atomic_size_t seq;
+    task *t;
+}
+slot;
+
+// a work queue, a bounded multi-producer/multi-consumer ring
+// that takes the tasks submitted from outside the pool.
+// head and tail live on their own cache lines so that
+// producers and workers do not bounce each other's line.
+typedef struct
+{
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    _Alignas(CACHE_LINE) atomic_size_t high_water;
+    _Alignas(CACHE_LINE) slot slots[QUEUE_SIZE];
+}
+work_queue;
+
+// one work queue per priority lane
+static work_queue queues[POOL_LANES];
+
+// a Chase-Lev work-stealing deque: the owning worker pushes and
+// takes at the bottom, other workers steal from the top
+typedef struct
+{
+    _Alignas(CACHE_LINE) atomic_long top;
+    _Alignas(CACHE_LINE) atomic_long bottom;
+    _Alignas(CACHE_LINE) _Atomic(task *) buf[DEQUE_SIZE];
+}
+deque;
+
+// returned by deque_steal() when it lost a race for the top task
+static task steal_aborted;
+#define ABORT (&steal_aborted)
+
+// a bee slot is free, has a running worker, or has a worker
+// that retired and still has to be joined
+enum { BEE_FREE, BEE_RUNNING, BEE_EXITED };
+
+// counters kept by one worker; only that worker writes them,
+// so they are bumped with a plain load and store and readers
+// can never see a torn value
+typedef _Atomic unsigned long long counter;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE) counter tasks;
+    counter busy_ns;
+    counter idle_ns;
+    counter wait[POOL_HISTOGRAM_BUCKETS];
+    counter run[POOL_HISTOGRAM_BUCKETS];
+    uint64_t last;          // when the worker last became idle
+}
+bee_stats;
+
+// the worker bees, each with its own deque
+struct bee
+{
+    deque *dq;              // set before the slot is published in nslots
+    int fresh;              // dq has not been touched by its worker yet
+    int cpu;                // the CPU the worker is pinned to, or -1
+    pthread_t thread;
+    unsigned int seed;
+    unsigned int picks;     // tasks found, for the starvation guard
+    int spins;              // polls before parking, see SPIN_MIN
+    int state;              // protected by resize_lock
+    bee_stats stats;
+};
+
+static struct bee bees[MAX_THREADS];
+
+// slots that have ever held a worker; thieves only look at these
+static atomic_int nslots;
+
+// running workers and the elastic limits
+static atomic_int nthreads;
+static int min_threads;
+static int max_threads;
+static int linger_ms;
+
+// CPUs that worker slots are pinned to, slot i on placement[i % nplacement]
+static int placement[MAX_THREADS];
+static int nplacement;
+
+// serializes starting and retiring workers
+static pthread_mutex_t resize_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the bee the calling thread is, or NULL outside the pool
+static __thread struct bee *current;
+
+// number of workers that found nothing to do and may be asleep
+static atomic_int idle_workers;
+
+// workers that have been started but have not looked for work yet
+static atomic_int starting_workers;
 
-// the worker bee
-pthread_t bee;
+// the event count idle workers park on: a worker reads it before its
+// last look at the queues and sleeps only if it is unchanged, and
+// every wake-up bumps it, so a wake-up cannot slip in between
+static atomic_uint wake_epoch;
 
-// insert a task into the queue
-// returns 0 if successful or 1 otherwise, 
-int enqueue(task t) 
+// 0 while running, then SHUTDOWN_DRAIN or SHUTDOWN_ABORT
+static atomic_int shutting_down;
+#define SHUTDOWN_DRAIN 1
+#define SHUTDOWN_ABORT 2
+
+// producers blocked in pool_submit_timed() wait on space_cond
+// for a worker to take a task off a full queue
+static atomic_int blocked_producers;
+static pthread_mutex_t space_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t space_cond;
+
+// submits that found no room, or came after the pool began shutting down
+static atomic_ulong rejected;
+
+// tasks that became ready during an abort but were refused by the
+// work queues; pool_shutdown_mode() drops them with the rest
+static _Atomic(task *) stranded;
+
+// the completion channel: tasks from pool_submit_completion() that
+// have run, newest first, pushed by the workers; the consumer moves
+// them to completed_taken, oldest first, and owns them from there
+static _Atomic(task *) completed;
+static task *completed_taken;
+static atomic_int completion_signalled;    // completion_fd has been written since the consumer last looked
+static int completion_fd = -1;
+
+// a timer is waiting in the wheel, queued as a task, running,
+// or done and only kept for its handles
+enum { TIMER_WAITING, TIMER_QUEUED, TIMER_RUNNING, TIMER_DONE };
+
+// work for pool_submit_after() and pool_submit_every()
+struct pool_timer
+{
+    struct pool_timer *prev;    // links of its wheel slot
+    struct pool_timer *next;
+    void (*function)(void *p);
+    void *data;
+    uint64_t expires;           // tick it is due at
+    uint64_t period;            // ticks between runs, 0 runs once
+    int level;                  // where it is in the wheel
+    int index;
+    int state;
+    int cancelled;
+    atomic_int refs;            // the caller's handle plus one for the pool
+};
+
+// the timing wheel, owned by the timer thread; everything is under timer_lock
+static pool_timer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t wheel_occupied[TIMER_LEVELS];  // bit i set if slot i is not empty
+static uint64_t wheel_tick;     // last tick handled
+static uint64_t wheel_wake;     // tick the timer thread sleeps until
+static uint64_t wheel_base_ns;  // CLOCK_MONOTONIC ns of tick 0
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static pthread_t timer_thread;
+static int timer_running;
+static int timers_stopping;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// raise the high water mark of a queue to its depth below tail; the
+// depth is approximate, and high_water is only written when it grows
+static void raise_high_water(work_queue *queue, size_t tail)
+{
+    size_t depth = tail - atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t mark = atomic_load_explicit(&queue->high_water, memory_order_relaxed);
+
+    while (depth > mark && depth <= QUEUE_SIZE &&
+        ! atomic_compare_exchange_weak_explicit(&queue->high_water, &mark, depth,
+            memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+// insert a task into the work queue of its lane
+// returns 0 if successful or 1 otherwise,
+int enqueue(task *t)
 {
+    work_queue *queue = &queues[t->priority];
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    slot *s;
+
+    for (;;) {
+        s = &queue->slots[pos & (QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            // the slot is free, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            // the slot still holds a task from the previous lap: full
+            return 1;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    s->t = t;
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+
+    if ((pos + 1) % HIGH_WATER_SAMPLE == 0)
+        raise_high_water(queue, pos + 1);
+
     return 0;
 }
 
-// remove a task from the queue
-task dequeue() 
+// remove a task from the queue of a lane
+// returns 0 if successful or 1 if the queue is empty
+int dequeue(int lane, task **t)
 {
-    return worktodo;
+    work_queue *queue = &queues[lane];
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    slot *s;
+
+    for (;;) {
+        s = &queue->slots[pos & (QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            // nothing published at pos yet
+            return 1;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    *t = s->t;
+    // hand the slot to the producer one lap ahead
+    atomic_store_explicit(&s->seq, pos + QUEUE_SIZE, memory_order_release);
+
+    // let producers blocked on a full queue know there is room
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&blocked_producers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&space_lock);
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&space_lock);
+    }
+
+    return 0;
 }
 
-// the worker thread in the thread pool
-void *worker(void *param)
+// insert up to n tasks of the same lane into its queue
+// with a single claim of the tail
+// returns the number of tasks inserted
+static int enqueue_batch(task **t, int n)
 {
-    // execute the task
-    execute(worktodo.function, worktodo.data);
+    work_queue *queue = &queues[t[0]->priority];
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    int i, free_slots;
 
-    pthread_exit(0);
+    for (;;) {
+        // count the consecutive free slots from pos
+        for (free_slots = 0; free_slots < n; free_slots++) {
+            slot *s = &queue->slots[(pos + free_slots) & (QUEUE_SIZE - 1)];
+            size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+
+            if (seq != pos + free_slots)
+                break;
+        }
+
+        if (free_slots == 0) {
+            slot *s = &queue->slots[pos & (QUEUE_SIZE - 1)];
+            intptr_t diff = (intptr_t) atomic_load_explicit(&s->seq, memory_order_acquire) - (intptr_t) pos;
+
+            if (diff < 0)
+                return 0;
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + free_slots,
+                memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+
+    for (i = 0; i < free_slots; i++) {
+        slot *s = &queue->slots[(pos + i) & (QUEUE_SIZE - 1)];
+
+        s->t = t[i];
+        atomic_store_explicit(&s->seq, pos + i + 1, memory_order_release);
+    }
+
+    // sample as enqueue() would have somewhere in the batch
+    if (pos / HIGH_WATER_SAMPLE != (pos + free_slots) / HIGH_WATER_SAMPLE)
+        raise_high_water(queue, pos + free_slots);
+
+    return free_slots;
 }
 
-/**
- * Executes the task provided to the thread pool
- */
-void execute(void (*somefunction)(void *p), void *p)
+// push a task onto the bottom of the calling worker's deque
+// returns 0 if successful or 1 if the deque is full
+static int deque_push(deque *d, task *t)
 {
-    (*somefunction)(p);
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - top >= DEQUE_SIZE)
+        return 1;
+
+    atomic_store_explicit(&d->buf[b & (DEQUE_SIZE - 1)], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+
+    return 0;
 }
 
-/**
- * Submits work to the pool.
- */
-int pool_submit(void (*somefunction)(void *p), void *p)
+// take the most recently pushed task from the calling worker's deque
+static task *deque_take(deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long top;
+    task *t = NULL;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top <= b) {
+        t = atomic_load_explicit(&d->buf[b & (DEQUE_SIZE - 1)], memory_order_relaxed);
+        if (top == b) {
+            // last task: race the thieves for it
+            if (! atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                t = NULL;
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return t;
+}
+
+// steal the oldest task from another worker's deque
+// returns NULL if it is empty or ABORT if another thread won the race
+static task *deque_steal(deque *d)
+{
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    task *t;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (top >= b)
+        return NULL;
+
+    t = atomic_load_explicit(&d->buf[top & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (! atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return ABORT;
+
+    return t;
+}
+
+// try the other workers' deques, starting from a random victim
+static task *steal(struct bee *self)
+{
+    int n = atomic_load_explicit(&nslots, memory_order_acquire);
+    int aborted;
+
+    do {
+        int start, i;
+
+        aborted = 0;
+        self->seed = self->seed * 1103515245 + 12345;
+        start = (self->seed >> 16) % n;
+
+        for (i = 0; i < n; i++) {
+            struct bee *victim = &bees[(start + i) % n];
+            task *t;
+
+            if (victim == self)
+                continue;
+
+            t = deque_steal(victim->dq);
+            if (t == ABORT)
+                aborted = 1;
+            else if (t != NULL)
+                return t;
+        }
+    } while (aborted);
+
+    return NULL;
+}
+
+// look for a task in one lane; the deques belong to the normal lane:
+// own deque first, then the work queue, then the others
+static task *find_in_lane(struct bee *self, int lane)
+{
+    task *t;
+
+    if (lane == POOL_PRIORITY_NORMAL && (t = deque_take(self->dq)) != NULL)
+        return t;
+
+    if (dequeue(lane, &t) == 0)
+        return t;
+
+    if (lane == POOL_PRIORITY_NORMAL)
+        return steal(self);
+
+    return NULL;
+}
+
+// find the next task, draining higher lanes first except that every
+// STARVATION_LIMIT-th pick starts from the lowest lane; only a look
+// that finds a task counts as a pick, not the empty polls of spin()
+static task *find_task(struct bee *self)
+{
+    task *t = NULL;
+    int i;
+
+    if ((self->picks + 1) % STARVATION_LIMIT == 0) {
+        for (i = POOL_LANES - 1; i >= 0 && t == NULL; i--)
+            t = find_in_lane(self, i);
+    }
+    else {
+        for (i = 0; i < POOL_LANES && t == NULL; i++)
+            t = find_in_lane(self, i);
+    }
+
+    if (t != NULL)
+        self->picks++;
+
+    return t;
+}
+
+// wake up to n idle workers after new work has been published;
+// costs no system call while every worker is busy or spinning
+static void notify(int n)
+{
+    int idle;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    idle = atomic_load(&idle_workers);
+    if (idle == 0)
+        return;
+
+    atomic_fetch_add(&wake_epoch, 1);
+    syscall(SYS_futex, &wake_epoch, FUTEX_WAKE_PRIVATE, n < idle ? n : idle, NULL, NULL, 0);
+}
+
+static void release_task(pool_future *f);
+static void fiber_resume(struct fiber *f);
+static void maybe_grow(int lane);
+
+// mark count tasks of a future as finished
+static void future_complete(pool_future *f, int count)
+{
+    edge *e, *next;
+
+    if (atomic_fetch_sub(&f->pending, count) == count) {
+        // tasks that depend on this one may now be ready
+        e = atomic_exchange_explicit(&f->successors, CLOSED, memory_order_acq_rel);
+        for (; e != NULL; e = next) {
+            next = e->next;
+            if (e->fiber != NULL)
+                fiber_resume(e->fiber);
+            else
+                release_task(e->succ);
+            free(e);
+        }
+
+        sem_post(&f->done);
+        pool_future_release(f);
+    }
+}
+
+static pool_future *future_create(int pending)
+{
+    pool_future *f = malloc(sizeof(pool_future));
+
+    if (f == NULL)
+        return NULL;
+
+    atomic_init(&f->pending, pending);
+    atomic_init(&f->refs, pending > 0 ? 2 : 1);
+    sem_init(&f->done, 0, pending > 0 ? 0 : 1);
+    atomic_init(&f->successors, pending > 0 ? NULL : CLOSED);
+    atomic_init(&f->waiting, 0);
+    f->deferred = NULL;
+
+    return f;
+}
+
+// a thread is exiting: leave its cache for the next new thread
+static void orphan_cache(void *param)
+{
+    node_cache *c = param;
+
+    pthread_mutex_lock(&cache_lock);
+    c->next_orphan = orphans;
+    orphans = c;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void make_cache_key(void)
+{
+    pthread_key_create(&cache_key, orphan_cache);
+}
+
+static node_cache *get_cache(void)
+{
+    node_cache *c;
+
+    if (my_cache != NULL)
+        return my_cache;
+
+    pthread_once(&cache_once, make_cache_key);
+
+    pthread_mutex_lock(&cache_lock);
+    if ((c = orphans) != NULL)
+        orphans = c->next_orphan;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (c == NULL) {
+        if ((c = aligned_alloc(CACHE_LINE, sizeof(node_cache))) == NULL)
+            return NULL;
+        c->free = NULL;
+        atomic_init(&c->remote, NULL);
+    }
+
+    pthread_setspecific(cache_key, c);
+    my_cache = c;
+
+    return c;
+}
+
+// take a task node from the calling thread's cache
+static task *node_alloc(void)
+{
+    node_cache *c = get_cache();
+    task *t, *slab;
+    int i;
+
+    if (c == NULL)
+        return NULL;
+
+    if ((t = c->free) == NULL)
+        t = atomic_exchange_explicit(&c->remote, NULL, memory_order_acquire);
+
+    if (t == NULL) {
+        if ((slab = aligned_alloc(CACHE_LINE, sizeof(task) * NODES_PER_SLAB)) == NULL)
+            return NULL;
+        for (i = 0; i < NODES_PER_SLAB; i++) {
+            slab[i].owner = c;
+            slab[i].next = i + 1 < NODES_PER_SLAB ? &slab[i + 1] : NULL;
+        }
+        t = slab;
+    }
+
+    c->free = t->next;
+
+    return t;
+}
+
+// give a task node back to the cache it came from
+static void node_free(task *t)
+{
+    node_cache *c;
+
+    if (t == NULL)
+        return;
+
+    if (t->heap_arg)
+        free(t->data);
+
+    c = t->owner;
+    if (c == my_cache) {
+        t->next = c->free;
+        c->free = t;
+        return;
+    }
+
+    t->next = atomic_load_explicit(&c->remote, memory_order_relaxed);
+    while (! atomic_compare_exchange_weak_explicit(&c->remote, &t->next, t,
+            memory_order_release, memory_order_relaxed))
+        ;
+}
+
+static task *task_create(void (*function)(void *p), void *data, pool_future *future, int priority)
+{
+    task *t = node_alloc();
+
+    if (t == NULL)
+        return NULL;
+
+    t->function = function;
+    t->data = data;
+    t->future = future;
+    t->priority = priority;
+    t->heap_arg = 0;
+    t->completion = 0;
+
+    return t;
+}
+
+// whether new work may still be queued: not once an abort has begun,
+// and during a drain only from a worker, which looks at the queues
+// again before it exits
+static int accepting(void)
+{
+    int mode = atomic_load_explicit(&shutting_down, memory_order_relaxed);
+
+    return mode == 0 || (mode == SHUTDOWN_DRAIN && current != NULL);
+}
+
+// put a task on the calling worker's deque or the work queue of its lane
+// returns 0 if successful or 1 if there is no room or the pool is
+// shutting down
+static int try_submit(task *t)
 {
-    worktodo.function = somefunction;
-    worktodo.data = p;
+    int lane = t->priority;
+    int local = current != NULL && lane == POOL_PRIORITY_NORMAL;
+
+    if (! accepting())
+        return 1;
+
+    t->submitted = now_ns();
+
+    if ((! local || deque_push(current->dq, t) != 0) && enqueue(t) != 0)
+        return 1;
+
+    // t may have run and been freed from here on
+    notify(1);
+    if (linger_ms > 0)
+        maybe_grow(lane);
 
     return 0;
 }
 
-// initialize the thread pool
-void pool_init(void)
+// try_submit() and count the task as rejected if it was refused
+static int submit_task(task *t)
 {
-    pthread_create(&bee,NULL,worker,NULL);
+    if (try_submit(t) != 0) {
+        atomic_fetch_add_explicit(&rejected, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    return 0;
 }
 
-// shutdown the thread pool
-void pool_shutdown(void)
+// keep a task that must not run for the abort to drop
+static void strand(task *t)
+{
+    t->next = atomic_load_explicit(&stranded, memory_order_relaxed);
+    while (! atomic_compare_exchange_weak(&stranded, &t->next, t))
+        ;
+}
+
+// one dependency of a graph task has finished, or it was submitted;
+// queue it when that was the last thing it waited for
+static void release_task(pool_future *f)
 {
-    pthread_join(bee,NULL);
+    task *t;
+
+    if (atomic_fetch_sub(&f->waiting, 1) != 1)
+        return;
+
+    t = f->deferred;
+    f->deferred = NULL;
+
+    if (submit_task(t) == 0)
+        return;
+
+    // an abort must not run it; otherwise a full pool must not lose
+    // the task, so whoever released it runs it
+    if (atomic_load(&shutting_down) == SHUTDOWN_ABORT) {
+        strand(t);
+    }
+    else {
+        execute(t->function, t->data);
+        node_free(t);
+        future_complete(f, 1);
+    }
+}
+
+static void stat_add(counter *c, unsigned long long v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// histogram bucket i holds latencies in [2^i, 2^(i+1)) ns
+static int bucket(uint64_t ns)
+{
+    int b = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+
+    return b < POOL_HISTOGRAM_BUCKETS ? b : POOL_HISTOGRAM_BUCKETS - 1;
+}
+
+// account for one task run by the calling worker
+static void record(struct bee *self, uint64_t waited, uint64_t start, uint64_t end)
+{
+    bee_stats *st = &self->stats;
+
+    stat_add(&st->tasks, 1);
+    stat_add(&st->busy_ns, end - start);
+    stat_add(&st->idle_ns, start - st->last);
+    stat_add(&st->wait[bucket(waited)], 1);
+    stat_add(&st->run[bucket(end - start)], 1);
+    st->last = end;
+}
+
+// queue k runner tasks on the calling worker's deque, or with a
+// single claim of the normal lane's work queue, and wake workers
+// returns the number of runners queued
+static int submit_runners(task **runners, int k)
+{
+    uint64_t now = now_ns();
+    int i, queued = 0;
+
+    if (! accepting())
+        return 0;
+
+    for (i = 0; i < k; i++)
+        runners[i]->submitted = now;
+
+    if (current != NULL) {
+        while (queued < k && deque_push(current->dq, runners[queued]) == 0)
+            queued++;
+    }
+    if (queued < k)
+        queued += enqueue_batch(runners + queued, k - queued);
+
+    if (queued > 0) {
+        notify(queued);
+        if (linger_ms > 0)
+            maybe_grow(POOL_PRIORITY_NORMAL);
+    }
+
+    return queued;
+}
+
+static void batch_release(batch *b)
+{
+    if (atomic_fetch_sub(&b->refs, 1) == 1)
+        free(b);
+}
+
+// run items of a batch until none are left
+static void batch_run(void *param)
+{
+    batch *b = param;
+    int i, done = 0;
+
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->n) {
+        execute(b->function, b->data[i]);
+        done++;
+    }
+
+    // the runner itself is counted by the worker
+    if (done > 1 && current != NULL)
+        stat_add(&current->stats.tasks, done - 1);
+
+    if (done > 0)
+        future_complete(b->future, done);
+
+    batch_release(b);
+}
+
+// start a worker in a free slot; called with resize_lock held
+// returns 0 if successful or 1 otherwise
+static int start_bee(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_THREADS; i++) {
+        struct bee *b = &bees[i];
+
+        if (b->state == BEE_RUNNING)
+            continue;
+        if (b->state == BEE_EXITED)
+            pthread_join(b->thread,NULL);
+
+        // the pages are only mapped here; the worker touches them
+        // first so that they land on its NUMA node
+        if (b->dq == NULL) {
+            void *mem = mmap(NULL, sizeof(deque), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (mem == MAP_FAILED)
+                return 1;
+            b->dq = mem;
+            b->fresh = 1;
+        }
+        b->cpu = nplacement > 0 ? placement[i % nplacement] : -1;
+
+        // publish the slot before the worker can start stealing
+        if (i >= atomic_load(&nslots))
+            atomic_store_explicit(&nslots, i + 1, memory_order_release);
+
+        b->state = BEE_RUNNING;
+        atomic_fetch_add(&starting_workers, 1);
+        if (pthread_create(&b->thread,NULL,worker,b) != 0) {
+            atomic_fetch_sub(&starting_workers, 1);
+            b->state = BEE_FREE;
+            return 1;
+        }
+
+        atomic_fetch_add(&nthreads, 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+// add a worker to an elastic pool when lane has work waiting and no
+// worker is idle to take it. Submitters call it, so that the pool
+// grows while every worker is busy, and so does a worker taking a
+// task, for a backlog that was queued while it was waking up
+static void maybe_grow(int lane)
+{
+    work_queue *queue = &queues[lane];
+    int waiting;
+
+    if (atomic_load(&nthreads) >= max_threads)
+        return;
+
+    // notify() has fenced, so this sees workers that went to sleep;
+    // one that is still starting will take the work too
+    if (atomic_load_explicit(&idle_workers, memory_order_relaxed) > 0 ||
+        atomic_load_explicit(&starting_workers, memory_order_relaxed) > 0)
+        return;
+
+    // a spinning worker may have taken the work already
+    waiting = atomic_load_explicit(&queue->tail, memory_order_relaxed) !=
+        atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (! waiting && current != NULL && lane == POOL_PRIORITY_NORMAL)
+        waiting = atomic_load_explicit(&current->dq->bottom, memory_order_relaxed) >
+            atomic_load_explicit(&current->dq->top, memory_order_relaxed);
+    if (! waiting)
+        return;
+
+    // other submitters do not wait while one starts a worker
+    if (pthread_mutex_trylock(&resize_lock) != 0)
+        return;
+    if (! atomic_load(&shutting_down) && atomic_load(&nthreads) < max_threads)
+        start_bee();
+    pthread_mutex_unlock(&resize_lock);
+}
+
+// retire the calling worker if the pool is above its minimum size
+// returns 1 if the worker should exit
+static int retire(struct bee *self)
+{
+    int retired = 0;
+
+    pthread_mutex_lock(&resize_lock);
+    if (atomic_load(&nthreads) > min_threads) {
+        atomic_fetch_sub(&nthreads, 1);
+        self->state = BEE_EXITED;
+        retired = 1;
+    }
+    pthread_mutex_unlock(&resize_lock);
+
+    return retired;
+}
+
+// sleep until wake_epoch moves on from key; a worker of an elastic
+// pool above its minimum size gives up after linger_ms
+// returns 1 if the wait timed out
+static int sleep_idle(unsigned int key)
+{
+    struct timespec left, *timeout = NULL;
+    uint64_t deadline = 0, now;
+
+    if (linger_ms > 0 && atomic_load(&nthreads) > min_threads) {
+        deadline = now_ns() + (uint64_t) linger_ms * 1000000;
+        timeout = &left;
+    }
+
+    // returns as soon as wake_epoch is no longer key; EINTR and
+    // spurious wake-ups go round again
+    while (atomic_load(&wake_epoch) == key) {
+        if (timeout != NULL) {
+            if ((now = now_ns()) >= deadline)
+                return 1;
+            left.tv_sec = (deadline - now) / 1000000000;
+            left.tv_nsec = (deadline - now) % 1000000000;
+        }
+        syscall(SYS_futex, &wake_epoch, FUTEX_WAIT_PRIVATE, key, timeout, NULL, 0);
+    }
+
+    return 0;
+}
+
+// poll the queues for a while before parking, since a task that
+// shows up soon is picked up much faster than a sleeper is woken
+static task *spin(struct bee *self)
+{
+    task *t = NULL;
+    int i;
+
+    for (i = 0; i < self->spins && t == NULL; i++) {
+        cpu_relax();
+        t = find_task(self);
+    }
+
+    if (t != NULL)
+        self->spins = self->spins * 2 < SPIN_MAX ? self->spins * 2 : SPIN_MAX;
+    else
+        self->spins = self->spins / 2 > SPIN_MIN ? self->spins / 2 : SPIN_MIN;
+
+    return t;
+}
+
+// pin the calling worker and fault in its deque on the local node
+static void bee_setup(struct bee *self)
+{
+    if (self->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(self->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    if (self->fresh) {
+        size_t i;
+
+        atomic_store(&self->dq->top, 0);
+        atomic_store(&self->dq->bottom, 0);
+        for (i = 0; i < DEQUE_SIZE; i++)
+            atomic_store_explicit(&self->dq->buf[i], NULL, memory_order_relaxed);
+        self->fresh = 0;
+    }
+
+    self->stats.last = now_ns();
+}
+
+// hand a task that has run to the completion channel; only the
+// first completion the consumer has not looked for yet writes to
+// completion_fd, the others ride along
+static void post_completion(task *t)
+{
+    uint64_t one = 1;
+
+    t->next = atomic_load_explicit(&completed, memory_order_relaxed);
+    while (! atomic_compare_exchange_weak(&completed, &t->next, t))
+        ;
+
+    // EAGAIN means the counter is full, so the fd is readable anyway;
+    // otherwise the consumer was not told and the next completion tries
+    if (atomic_exchange(&completion_signalled, 1) == 0 &&
+        write(completion_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        atomic_store(&completion_signalled, 0);
+}
+
+// the worker thread in the thread pool
+void *worker(void *param)
+{
+    struct bee *self = param;
+    uint64_t start;
+    task *t;
+
+    current = self;
+    bee_setup(self);
+    atomic_fetch_sub(&starting_workers, 1);
+
+    while (TRUE) {
+        // an aborting pool leaves what is queued to pool_shutdown_mode()
+        if (atomic_load_explicit(&shutting_down, memory_order_relaxed) == SHUTDOWN_ABORT)
+            break;
+
+        if ((t = find_task(self)) == NULL)
+            t = spin(self);
+
+        if (t == NULL) {
+            unsigned int key = atomic_load(&wake_epoch);
+            int timed_out;
+
+            // announce that we are going to sleep, then look once more
+            // so that a submit racing with us is not missed
+            atomic_fetch_add(&idle_workers, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            t = find_task(self);
+            if (t != NULL) {
+                atomic_fetch_sub(&idle_workers, 1);
+            }
+            else if (atomic_load(&shutting_down)) {
+                atomic_fetch_sub(&idle_workers, 1);
+                break;
+            }
+            else {
+                timed_out = sleep_idle(key);
+                atomic_fetch_sub(&idle_workers, 1);
+
+                // our deque is empty and only we push to it,
+                // so nothing is stranded when we leave
+                if (timed_out && (t = find_task(self)) == NULL && retire(self))
+                    break;
+                if (t == NULL)
+                    continue;
+            }
+        }
+
+        if (linger_ms > 0)
+            maybe_grow(t->priority);
+
+        start = now_ns();
+
+        // execute the task
+        execute(t->function, t->data);
+        record(self, start - t->submitted, start, now_ns());
+
+        if (t->future != NULL)
+            future_complete(t->future, 1);
+        if (t->completion)
+            post_completion(t);
+        else
+            node_free(t);
+    }
+
+    pthread_exit(0);
+}
+
+/**
+ * Executes the task provided to the thread pool
+ */
+void execute(void (*somefunction)(void *p), void *p)
+{
+    (*somefunction)(p);
+}
+
+/**
+ * Submits work to the pool.
+ * Work submitted from inside a task goes to the submitting
+ * worker's own deque; everything else goes to the work queue.
+ */
+int pool_submit(void (*somefunction)(void *p), void *p)
+{
+    return pool_submit_priority(somefunction, p, POOL_PRIORITY_NORMAL);
+}
+
+/**
+ * Submits work to one of the priority lanes of the pool.
+ * Workers drain POOL_PRIORITY_HIGH before POOL_PRIORITY_NORMAL
+ * before POOL_PRIORITY_LOW, but now and then take from the lowest
+ * lane first so that it is not starved.
+ * returns 0 if successful or 1 otherwise
+ */
+int pool_submit_priority(void (*somefunction)(void *p), void *p, int priority)
+{
+    task *t;
+
+    if (priority < 0)
+        priority = 0;
+    if (priority >= POOL_LANES)
+        priority = POOL_LANES - 1;
+
+    if ((t = task_create(somefunction, p, NULL, priority)) == NULL)
+        return 1;
+
+    if (submit_task(t) != 0) {
+        node_free(t);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Submits work to the pool with its argument copied by value.
+ * somefunction is called with a pointer to a copy of the size bytes
+ * at p, so the caller's copy may go away as soon as this returns.
+ * Arguments of up to POOL_INLINE_ARG bytes are stored in the task
+ * node itself, which comes from a per-thread cache, so the common
+ * case does not call malloc() at all.
+ * returns 0 if successful or 1 otherwise
+ */
+int pool_submit_copy(void (*somefunction)(void *p), const void *p, size_t size)
+{
+    task *t;
+
+    if ((t = task_create(somefunction, NULL, NULL, POOL_PRIORITY_NORMAL)) == NULL)
+        return 1;
+
+    if (size <= POOL_INLINE_ARG) {
+        t->data = t->arg;
+    }
+    else if ((t->data = malloc(size)) != NULL) {
+        t->heap_arg = 1;
+    }
+    else {
+        node_free(t);
+        return 1;
+    }
+    memcpy(t->data, p, size);
+
+    if (submit_task(t) != 0) {
+        node_free(t);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Submits work to the pool, waiting up to timeout_ms for room if the
+ * work queue is full instead of failing at once. A negative timeout
+ * waits for as long as it takes. Called from inside a task it never
+ * waits, since the workers that would make room may all be waiting.
+ * returns 0 if successful or 1 if there was no room in time or the
+ * pool is shutting down
+ */
+int pool_submit_timed(void (*somefunction)(void *p), void *p, int timeout_ms)
+{
+    struct timespec deadline;
+    int rc;
+    task *t;
+
+    if ((t = task_create(somefunction, p, NULL, POOL_PRIORITY_NORMAL)) == NULL)
+        return 1;
+
+    if ((rc = try_submit(t)) != 0 && current == NULL && timeout_ms != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&space_lock);
+        atomic_fetch_add(&blocked_producers, 1);
+
+        // retry after announcing ourselves, so that a worker that
+        // made room before it could see us is not missed
+        atomic_thread_fence(memory_order_seq_cst);
+        while ((rc = try_submit(t)) != 0 && ! atomic_load(&shutting_down)) {
+            if (timeout_ms < 0) {
+                pthread_cond_wait(&space_cond, &space_lock);
+            }
+            else if (pthread_cond_timedwait(&space_cond, &space_lock, &deadline) == ETIMEDOUT) {
+                rc = try_submit(t);
+                break;
+            }
+        }
+
+        atomic_fetch_sub(&blocked_producers, 1);
+        pthread_mutex_unlock(&space_lock);
+    }
+
+    if (rc != 0) {
+        atomic_fetch_add_explicit(&rejected, 1, memory_order_relaxed);
+        node_free(t);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Submits work to the pool that reports back through the completion
+ * channel: once somefunction(p) has run, p can be collected with
+ * pool_get_completions().
+ * returns 0 if successful or 1 if the pool is full
+ */
+int pool_submit_completion(void (*somefunction)(void *p), void *p)
+{
+    task *t;
+
+    if ((t = task_create(somefunction, p, NULL, POOL_PRIORITY_NORMAL)) == NULL)
+        return 1;
+    t->completion = 1;
+
+    if (submit_task(t) != 0) {
+        node_free(t);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns an eventfd that becomes readable when work submitted with
+ * pool_submit_completion() has run, for use with poll() or epoll.
+ * It stays valid until pool_shutdown(); do not read or close it.
+ */
+int pool_completion_fd(void)
+{
+    return completion_fd;
+}
+
+/**
+ * Stores up to n pointers of finished pool_submit_completion() work
+ * in p, oldest first, and returns how many, or -1 with errno set if
+ * completion_fd cannot be read. Call it from one thread
+ * at a time, and again as long as it fills all of p: completion_fd
+ * only becomes readable again for work that finishes after this.
+ */
+int pool_get_completions(void *p[], int n)
+{
+    task *t, *list, *next;
+    uint64_t count;
+    int i = 0;
+
+    if (completed_taken == NULL) {
+        // rearm before looking, so that a completion we miss here
+        // writes to completion_fd again
+        atomic_store(&completion_signalled, 0);
+
+        // EAGAIN just means nothing was written since the last look
+        if (completion_fd >= 0 && read(completion_fd, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN && errno != EINTR)
+            return -1;
+
+        for (list = atomic_exchange(&completed, NULL); list != NULL; list = next) {
+            next = list->next;
+            list->next = completed_taken;
+            completed_taken = list;
+        }
+    }
+
+    for (; i < n && (t = completed_taken) != NULL; i++) {
+        completed_taken = t->next;
+        p[i] = t->data;
+        node_free(t);
+    }
+
+    return i;
+}
+
+/**
+ * Submits work to the pool and returns a future that completes
+ * when it has run, or NULL if the work could not be queued.
+ * The future must be released with pool_future_release().
+ */
+pool_future *pool_submit_future(void (*somefunction)(void *p), void *p)
+{
+    pool_future *f = future_create(1);
+    task *t = f != NULL ? task_create(somefunction, p, f, POOL_PRIORITY_NORMAL) : NULL;
+
+    if (t == NULL) {
+        if (f != NULL) {
+            sem_destroy(&f->done);
+            free(f);
+        }
+        return NULL;
+    }
+
+    if (submit_task(t) != 0) {
+        node_free(t);
+        sem_destroy(&f->done);
+        free(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+/**
+ * Submits n tasks that each run somefunction(p[i]) and returns one
+ * future that completes when all of them have run, or NULL if the
+ * batch could not be queued. p must stay valid until then.
+ *
+ * The batch is handed to the pool as one runner per worker, queued
+ * with a single claim of the work queue (or pushed onto the calling
+ * worker's deque), so the queueing and wake-up cost is paid per
+ * worker rather than per task.
+ */
+pool_future *pool_submit_batch(void (*somefunction)(void *p), void *p[], int n)
+{
+    task *runners[MAX_THREADS];
+    int i, k, queued;
+    pool_future *f;
+    batch *b;
+
+    if (n <= 0)
+        return future_create(0);
+
+    k = atomic_load(&nthreads);
+    if (k > n)
+        k = n;
+
+    f = future_create(n);
+    b = malloc(sizeof(batch));
+    for (i = 0; i < k; i++)
+        runners[i] = task_create(batch_run, b, NULL, POOL_PRIORITY_NORMAL);
+
+    if (f == NULL || b == NULL)
+        goto fail;
+    for (i = 0; i < k; i++) {
+        if (runners[i] == NULL)
+            goto fail;
+    }
+
+    b->function = somefunction;
+    b->data = p;
+    b->n = n;
+    b->future = f;
+    atomic_init(&b->next, 0);
+    atomic_init(&b->refs, k);
+
+    if ((queued = submit_runners(runners, k)) == 0) {
+        atomic_fetch_add_explicit(&rejected, 1, memory_order_relaxed);
+        goto fail;
+    }
+
+    // drop the runners that did not fit; the queued ones still
+    // claim every item of the batch
+    for (i = queued; i < k; i++)
+        node_free(runners[i]);
+    if (queued < k && atomic_fetch_sub(&b->refs, k - queued) == k - queued)
+        free(b);
+
+    return f;
+
+fail:
+    for (i = 0; i < k; i++)
+        node_free(runners[i]);
+    free(b);
+    if (f != NULL) {
+        sem_destroy(&f->done);
+        free(f);
+    }
+    return NULL;
+}
+
+// claim and run chunks of a loop until the range is used up.
+// Chunks start at half a participant's fair share of what is left
+// and shrink as the loop drains, but never below the grain, so
+// early chunks are cheap to schedule and late ones balance the load.
+static void loop_work(loop *l, void *acc)
+{
+    long lo, hi, size;
+
+    for (;;) {
+        lo = atomic_load_explicit(&l->next, memory_order_relaxed);
+        do {
+            if (lo >= l->end)
+                return;
+            size = (l->end - lo) / (2 * l->participants);
+            if (size < l->grain)
+                size = l->grain;
+            hi = l->end - lo > size ? lo + size : l->end;
+        } while (! atomic_compare_exchange_weak_explicit(&l->next, &lo, hi,
+            memory_order_relaxed, memory_order_relaxed));
+
+        if (l->reduce != NULL)
+            l->reduce(lo, hi, acc, l->ctx);
+        else
+            l->body(lo, hi, l->ctx);
+
+        if (atomic_fetch_sub_explicit(&l->remaining, hi - lo, memory_order_acq_rel) == hi - lo)
+            sem_post(&l->done);
+    }
+}
+
+static void loop_release(loop *l)
+{
+    if (atomic_fetch_sub(&l->refs, 1) == 1) {
+        sem_destroy(&l->done);
+        free(l);
+    }
+}
+
+// a helper of a parallel loop
+static void loop_run(void *param)
+{
+    loop *l = param;
+    int slot = atomic_fetch_add(&l->slots, 1);
+
+    loop_work(l, l->acc + slot * l->stride);
+    loop_release(l);
+}
+
+// run a loop over [begin, end) with the calling thread taking part
+static void loop_start(long begin, long end, long grain,
+    void (*body)(long begin, long end, void *ctx),
+    void (*reduce)(long begin, long end, void *acc, void *ctx),
+    void (*combine)(void *acc, const void *other, void *ctx),
+    void *result, size_t size, void *ctx)
+{
+    task *runners[MAX_THREADS];
+    size_t stride = (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    long chunks;
+    int i, k, made, queued;
+    loop *l = NULL;
+
+    if (end <= begin)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    // one helper per worker, but no more than there are chunks to share
+    chunks = (end - begin + grain - 1) / grain;
+    k = atomic_load(&nthreads);
+    if (k > chunks - 1)
+        k = chunks - 1;
+
+    if (k > 0)
+        l = malloc(sizeof(loop) + (k + 1) * stride);
+
+    if (l == NULL) {
+        // too small to share, or no memory to share it with
+        if (reduce != NULL)
+            reduce(begin, end, result, ctx);
+        else
+            body(begin, end, ctx);
+        return;
+    }
+
+    l->end = end;
+    l->grain = grain;
+    l->participants = k + 1;
+    l->body = body;
+    l->reduce = reduce;
+    l->ctx = ctx;
+    l->stride = stride;
+    atomic_init(&l->next, begin);
+    atomic_init(&l->remaining, end - begin);
+    atomic_init(&l->slots, 1);
+    atomic_init(&l->refs, k + 1);
+    sem_init(&l->done, 0, 0);
+
+    // every participant of a reduction starts from the identity in result
+    if (reduce != NULL) {
+        for (i = 0; i <= k; i++)
+            memcpy(l->acc + i * stride, result, size);
+    }
+
+    for (made = 0; made < k; made++) {
+        if ((runners[made] = task_create(loop_run, l, NULL, POOL_PRIORITY_NORMAL)) == NULL)
+            break;
+    }
+    queued = made > 0 ? submit_runners(runners, made) : 0;
+    for (i = queued; i < made; i++)
+        node_free(runners[i]);
+    if (queued < k)
+        atomic_fetch_sub(&l->refs, k - queued);
+
+    loop_work(l, l->acc);
+
+    // wait for chunks the helpers are still running; helpers that
+    // have not started yet will find nothing left to claim
+    sem_wait(&l->done);
+
+    if (reduce != NULL) {
+        for (i = 1; i <= queued; i++)
+            combine(l->acc, l->acc + i * stride, ctx);
+        memcpy(result, l->acc, size);
+    }
+
+    loop_release(l);
+}
+
+/**
+ * Calls fn(lo, hi, ctx) over consecutive subranges that together
+ * cover [begin, end), in parallel on the pool. Subranges are at least
+ * grain long (except the last) and start large and get smaller as the
+ * range drains. The calling thread works on the range too and returns
+ * when all of it has been processed.
+ */
+void pool_parallel_for(long begin, long end, long grain,
+    void (*fn)(long begin, long end, void *ctx), void *ctx)
+{
+    loop_start(begin, end, grain, fn, NULL, NULL, NULL, 0, ctx);
+}
+
+/**
+ * Like pool_parallel_for() but each participant folds its subranges
+ * into a private accumulator with fn(lo, hi, acc, ctx). The size-byte
+ * accumulators start as copies of *result, which must hold the
+ * identity of combine, and are folded together with
+ * combine(acc, other, ctx) into *result at the end. combine must be
+ * associative and commutative.
+ */
+void pool_parallel_reduce(long begin, long end, long grain,
+    void (*fn)(long begin, long end, void *acc, void *ctx),
+    void (*combine)(void *acc, const void *other, void *ctx),
+    void *result, size_t size, void *ctx)
+{
+    loop_start(begin, end, grain, NULL, fn, combine, result, size, ctx);
+}
+
+/**
+ * Creates a graph task that runs somefunction(p) once it has been
+ * submitted with pool_task_submit() and every dependency added with
+ * pool_task_after() has completed. The returned future is the handle
+ * for both, and must be released with pool_future_release().
+ * returns NULL if out of memory
+ */
+pool_future *pool_task_create(void (*somefunction)(void *p), void *p)
+{
+    pool_future *f = future_create(1);
+
+    if (f == NULL)
+        return NULL;
+
+    if ((f->deferred = task_create(somefunction, p, f, POOL_PRIORITY_NORMAL)) == NULL) {
+        sem_destroy(&f->done);
+        free(f);
+        return NULL;
+    }
+
+    // held until pool_task_submit()
+    atomic_init(&f->waiting, 1);
+
+    return f;
+}
+
+/**
+ * Makes the graph task t wait for each of the n futures in deps, which
+ * may come from any of the submit calls or be other graph tasks.
+ * Dependencies that have already completed are skipped. It must be
+ * called before t is submitted.
+ * returns 0 if successful or 1 if t is not a graph task or out of memory
+ */
+int pool_task_after(pool_future *t, pool_future *deps[], int n)
+{
+    edge *e;
+    int i;
+
+    if (t->deferred == NULL)
+        return 1;
+
+    for (i = 0; i < n; i++) {
+        if ((e = malloc(sizeof(edge))) == NULL)
+            return 1;
+        e->succ = t;
+        e->fiber = NULL;
+
+        // count it first, so that a dependency completing right
+        // after the push cannot release t early
+        atomic_fetch_add(&t->waiting, 1);
+
+        e->next = atomic_load_explicit(&deps[i]->successors, memory_order_acquire);
+        do {
+            if (e->next == CLOSED) {
+                atomic_fetch_sub(&t->waiting, 1);
+                free(e);
+                break;
+            }
+        } while (! atomic_compare_exchange_weak_explicit(&deps[i]->successors, &e->next, e,
+                memory_order_acq_rel, memory_order_acquire));
+    }
+
+    return 0;
+}
+
+/**
+ * Submits a graph task. It is queued right away if its dependencies
+ * have completed, otherwise by whichever finishes last. If the pool
+ * is full at that moment, the thread that released it runs it.
+ */
+void pool_task_submit(pool_future *t)
+{
+    release_task(t);
+}
+
+static void fiber_free(fiber *f)
+{
+    munmap(f->stack, FIBER_STACK_SIZE + sysconf(_SC_PAGESIZE));
+    free(f);
+}
+
+static void fiber_entry(void)
+{
+    fiber *f = this_fiber;
+
+    execute(f->function, f->data);
+
+    // never returns; fiber_run() frees the stack we are on
+    f->done = 1;
+    setcontext(f->caller);
+}
+
+static fiber *fiber_create(void (*function)(void *p), void *data)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    fiber *f = malloc(sizeof(fiber));
+
+    if (f == NULL)
+        return NULL;
+
+    f->stack = mmap(NULL, FIBER_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (f->stack == MAP_FAILED) {
+        free(f);
+        return NULL;
+    }
+    mprotect(f->stack, page, PROT_NONE);
+
+    getcontext(&f->ctx);
+    f->ctx.uc_stack.ss_sp = f->stack + page;
+    f->ctx.uc_stack.ss_size = FIBER_STACK_SIZE;
+    f->ctx.uc_link = NULL;
+    makecontext(&f->ctx, fiber_entry, 0);
+
+    f->function = function;
+    f->data = data;
+    f->started = 0;
+    f->done = 0;
+
+    return f;
+}
+
+// the task that runs a fiber until it finishes or suspends
+static void fiber_run(void *param)
+{
+    fiber *f = param, *outer = this_fiber;
+    ucontext_t here;
+
+    f->caller = &here;
+    f->started = 1;
+    this_fiber = f;
+    swapcontext(&here, &f->ctx);
+    this_fiber = outer;
+
+    if (f->done) {
+        fiber_free(f);
+        return;
+    }
+
+    // only now that nothing runs on its stack any more may anybody
+    // resume it, so this is where it gets on a wait list
+    f->park(f, f->park_arg);
+}
+
+// switch from the running fiber back to the worker, which then calls
+// park(f, arg); the fiber continues from here once it is resumed
+static void fiber_suspend(void (*park)(fiber *f, void *arg), void *arg)
+{
+    fiber *f = this_fiber;
+
+    f->park = park;
+    f->park_arg = arg;
+    swapcontext(&f->ctx, f->caller);
+}
+
+// queue a suspended fiber to continue
+static void fiber_resume(fiber *f)
+{
+    task *t = task_create(fiber_run, f, NULL, POOL_PRIORITY_NORMAL);
+
+    if (t != NULL && submit_task(t) == 0)
+        return;
+
+    // an abort must not run it; otherwise a full pool must not lose
+    // the fiber, so whoever resumed it runs it
+    if (t != NULL && atomic_load(&shutting_down) == SHUTDOWN_ABORT) {
+        strand(t);
+        return;
+    }
+    node_free(t);
+    fiber_run(f);
+}
+
+// park hooks: what a worker does right after a fiber switched out
+
+static void park_yield(fiber *f, void *arg)
+{
+    task *t = task_create(fiber_run, f, NULL, POOL_PRIORITY_NORMAL);
+
+    // to the back of the work queue, so that what is already queued
+    // gets a turn first
+    if (t != NULL) {
+        t->submitted = now_ns();
+        if (enqueue(t) == 0) {
+            notify(1);
+            return;
+        }
+    }
+
+    node_free(t);
+    fiber_resume(f);
+}
+
+static void park_unlock(fiber *f, void *arg)
+{
+    pthread_mutex_unlock(arg);
+}
+
+static void park_future(fiber *f, void *arg)
+{
+    pool_future *future = arg;
+    edge *e = malloc(sizeof(edge));
+
+    // without an edge, poll again after the others had a turn
+    if (e == NULL) {
+        park_yield(f, NULL);
+        return;
+    }
+    e->succ = NULL;
+    e->fiber = f;
+
+    e->next = atomic_load_explicit(&future->successors, memory_order_acquire);
+    do {
+        if (e->next == CLOSED) {
+            free(e);
+            fiber_resume(f);
+            return;
+        }
+    } while (! atomic_compare_exchange_weak_explicit(&future->successors, &e->next, e,
+            memory_order_acq_rel, memory_order_acquire));
+}
+
+/**
+ * Submits work to the pool to run as a fiber: on a small stack of its
+ * own, so that it can call pool_yield(), wait on a pool_event or
+ * pool_mutex, or wait on a future, without holding up a worker. It
+ * may continue on a different worker after each of these, so it must
+ * not hold a pthread mutex or rely on thread-local data across them.
+ * returns 0 if successful or 1 if the pool is full or out of memory
+ */
+int pool_spawn(void (*somefunction)(void *p), void *p)
+{
+    fiber *f = fiber_create(somefunction, p);
+    task *t = f != NULL ? task_create(fiber_run, f, NULL, POOL_PRIORITY_NORMAL) : NULL;
+
+    if (t == NULL || submit_task(t) != 0) {
+        node_free(t);
+        if (f != NULL)
+            fiber_free(f);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Called from a fiber, lets the tasks queued behind it run before it
+ * continues. Called from anywhere else, it yields the processor.
+ */
+void pool_yield(void)
+{
+    if (this_fiber != NULL)
+        fiber_suspend(park_yield, NULL);
+    else
+        sched_yield();
+}
+
+/**
+ * Creates an event, initially not set.
+ * returns NULL if out of memory
+ */
+pool_event *pool_event_create(void)
+{
+    pool_event *e = malloc(sizeof(pool_event));
+
+    if (e == NULL)
+        return NULL;
+
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    e->set = 0;
+    e->waiters = NULL;
+
+    return e;
+}
+
+/**
+ * Sets an event and lets everything that waits on it continue.
+ */
+void pool_event_set(pool_event *e)
+{
+    fiber *f, *next;
+
+    pthread_mutex_lock(&e->lock);
+    e->set = 1;
+    f = e->waiters;
+    e->waiters = NULL;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+
+    for (; f != NULL; f = next) {
+        next = f->next;
+        fiber_resume(f);
+    }
+}
+
+/**
+ * Waits until an event is set; a fiber is suspended meanwhile.
+ */
+void pool_event_wait(pool_event *e)
+{
+    pthread_mutex_lock(&e->lock);
+    if (this_fiber != NULL && ! e->set) {
+        this_fiber->next = e->waiters;
+        e->waiters = this_fiber;
+        fiber_suspend(park_unlock, &e->lock);
+        return;
+    }
+    while (! e->set)
+        pthread_cond_wait(&e->cond, &e->lock);
+    pthread_mutex_unlock(&e->lock);
+}
+
+void pool_event_destroy(pool_event *e)
+{
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->cond);
+    free(e);
+}
+
+/**
+ * Creates a mutex that suspends fibers instead of blocking workers.
+ * returns NULL if out of memory
+ */
+pool_mutex *pool_mutex_create(void)
+{
+    pool_mutex *m = malloc(sizeof(pool_mutex));
+
+    if (m == NULL)
+        return NULL;
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    m->locked = 0;
+    m->blocked_threads = 0;
+    m->head = m->tail = NULL;
+
+    return m;
+}
+
+void pool_mutex_lock(pool_mutex *m)
+{
+    pthread_mutex_lock(&m->lock);
+    if (this_fiber != NULL && m->locked) {
+        // pool_mutex_unlock() hands the mutex straight over to us
+        this_fiber->next = NULL;
+        if (m->tail != NULL)
+            m->tail->next = this_fiber;
+        else
+            m->head = this_fiber;
+        m->tail = this_fiber;
+        fiber_suspend(park_unlock, &m->lock);
+        return;
+    }
+
+    m->blocked_threads++;
+    while (m->locked)
+        pthread_cond_wait(&m->cond, &m->lock);
+    m->blocked_threads--;
+    m->locked = 1;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void pool_mutex_unlock(pool_mutex *m)
+{
+    fiber *f;
+
+    pthread_mutex_lock(&m->lock);
+    if ((f = m->head) != NULL) {
+        if ((m->head = f->next) == NULL)
+            m->tail = NULL;
+    }
+    else {
+        m->locked = 0;
+        if (m->blocked_threads > 0)
+            pthread_cond_signal(&m->cond);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    if (f != NULL)
+        fiber_resume(f);
+}
+
+void pool_mutex_destroy(pool_mutex *m)
+{
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->cond);
+    free(m);
+}
+
+/**
+ * Returns 1 if all the work behind the future has run, 0 otherwise.
+ */
+int pool_future_poll(pool_future *f)
+{
+    return atomic_load(&f->pending) == 0;
+}
+
+/**
+ * Waits until all the work behind the future has run. Called from a
+ * fiber, it suspends the fiber instead of blocking the worker.
+ */
+void pool_future_wait(pool_future *f)
+{
+    if (pool_future_poll(f))
+        return;
+
+    // a fiber is suspended until the future completes
+    if (this_fiber != NULL) {
+        while (! pool_future_poll(f))
+            fiber_suspend(park_future, f);
+        return;
+    }
+
+    // pass the wake-up on to any other waiter
+    sem_wait(&f->done);
+    sem_post(&f->done);
+}
+
+/**
+ * Releases the caller's handle on a future.
+ */
+void pool_future_release(pool_future *f)
+{
+    if (atomic_fetch_sub(&f->refs, 1) == 1) {
+        sem_destroy(&f->done);
+        free(f);
+    }
+}
+
+static uint64_t wheel_clock(void)
+{
+    return (now_ns() - wheel_base_ns) / TIMER_TICK_NS;
+}
+
+// put a timer in the slot that is handled when it is due, or when it
+// has to move down a level; anything beyond the top level's reach is
+// parked at its end and moved again from there
+static void wheel_insert(pool_timer *t)
+{
+    uint64_t delta = t->expires > wheel_tick ? t->expires - wheel_tick : 0;
+    uint64_t at = t->expires;
+    int level;
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < (uint64_t) 1 << (TIMER_SLOT_BITS * (level + 1)))
+            break;
+    }
+    if (delta >> (TIMER_SLOT_BITS * TIMER_LEVELS) != 0)
+        at = wheel_tick + ((uint64_t) 1 << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+
+    t->level = level;
+    t->index = (at >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+    t->prev = NULL;
+    t->next = wheel[level][t->index];
+    if (t->next != NULL)
+        t->next->prev = t;
+    wheel[level][t->index] = t;
+    wheel_occupied[level] |= (uint64_t) 1 << t->index;
+}
+
+static void wheel_remove(pool_timer *t)
+{
+    if (t->prev != NULL)
+        t->prev->next = t->next;
+    else
+        wheel[t->level][t->index] = t->next;
+    if (t->next != NULL)
+        t->next->prev = t->prev;
+
+    if (wheel[t->level][t->index] == NULL)
+        wheel_occupied[t->level] &= ~((uint64_t) 1 << t->index);
+}
+
+// the next tick at which the wheel has something to do,
+// or UINT64_MAX if it is empty
+static uint64_t wheel_next(void)
+{
+    uint64_t next = UINT64_MAX, bits;
+    int level, from;
+
+    if ((bits = wheel_occupied[0]) != 0) {
+        // rotate so that the slot after the current one is bit 0
+        from = (wheel_tick + 1) & (TIMER_SLOTS - 1);
+        bits = from == 0 ? bits : bits >> from | bits << (TIMER_SLOTS - from);
+        next = wheel_tick + 1 + __builtin_ctzll(bits);
+    }
+
+    // higher levels move down at the end of each turn of level 0
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        if (wheel_occupied[level] != 0) {
+            uint64_t turn = (wheel_tick | (TIMER_SLOTS - 1)) + 1;
+
+            return next < turn ? next : turn;
+        }
+    }
+
+    return next;
+}
+
+// advance the wheel to tick now and return the timers that are due,
+// linked through next
+static pool_timer *wheel_advance(uint64_t now)
+{
+    pool_timer *due = NULL, *t, *next;
+    int level, index;
+
+    while (wheel_tick < now) {
+        for (level = 0; level < TIMER_LEVELS && wheel_occupied[level] == 0; level++)
+            ;
+        if (level == TIMER_LEVELS) {
+            wheel_tick = now;
+            break;
+        }
+
+        wheel_tick++;
+
+        // at the end of a turn of a level, move the next slot of the
+        // level above down
+        for (level = 1; level < TIMER_LEVELS; level++) {
+            if ((wheel_tick & (((uint64_t) 1 << (TIMER_SLOT_BITS * level)) - 1)) != 0)
+                break;
+
+            index = (wheel_tick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+            t = wheel[level][index];
+            wheel[level][index] = NULL;
+            wheel_occupied[level] &= ~((uint64_t) 1 << index);
+            for (; t != NULL; t = next) {
+                next = t->next;
+                wheel_insert(t);
+            }
+        }
+
+        index = wheel_tick & (TIMER_SLOTS - 1);
+        for (t = wheel[0][index]; t != NULL; t = next) {
+            next = t->next;
+            t->state = TIMER_QUEUED;
+            t->next = due;
+            due = t;
+        }
+        wheel[0][index] = NULL;
+        wheel_occupied[0] &= ~((uint64_t) 1 << index);
+    }
+
+    return due;
+}
+
+// wake the timer thread if t is due before it would wake up
+static void wheel_schedule(pool_timer *t)
+{
+    t->state = TIMER_WAITING;
+    wheel_insert(t);
+    if (t->expires < wheel_wake)
+        pthread_cond_signal(&timer_cond);
+}
+
+// the task that runs a due timer
+static void timer_run(void *param)
+{
+    pool_timer *t = param;
+    int again;
+
+    pthread_mutex_lock(&timer_lock);
+    if (t->cancelled) {
+        t->state = TIMER_DONE;
+        pthread_mutex_unlock(&timer_lock);
+        pool_timer_release(t);
+        return;
+    }
+    t->state = TIMER_RUNNING;
+    pthread_mutex_unlock(&timer_lock);
+
+    execute(t->function, t->data);
+
+    // a periodic timer is due again one period after it was last
+    // due; runs it has fallen too far behind for are skipped
+    pthread_mutex_lock(&timer_lock);
+    again = t->period > 0 && ! t->cancelled && ! timers_stopping;
+    if (again) {
+        t->expires += t->period;
+        if (t->expires <= wheel_tick)
+            t->expires += ((wheel_tick - t->expires) / t->period + 1) * t->period;
+        wheel_schedule(t);
+    }
+    else {
+        t->state = TIMER_DONE;
+    }
+    pthread_mutex_unlock(&timer_lock);
+
+    if (! again)
+        pool_timer_release(t);
+}
+
+// hand due timers to the workers as they come up
+static void *timer_main(void *param)
+{
+    pool_timer *due, *t;
+    struct timespec ts;
+    uint64_t wake;
+    task *run;
+
+    pthread_mutex_lock(&timer_lock);
+    while (! timers_stopping) {
+        due = wheel_advance(wheel_clock());
+
+        pthread_mutex_unlock(&timer_lock);
+        for (t = due; t != NULL; t = due) {
+            due = t->next;
+            run = task_create(timer_run, t, NULL, POOL_PRIORITY_NORMAL);
+            if (run != NULL && submit_task(run) == 0)
+                continue;
+
+            // the pool is full; try again on the next tick
+            node_free(run);
+            pthread_mutex_lock(&timer_lock);
+            t->expires = wheel_tick + 1;
+            wheel_schedule(t);
+            pthread_mutex_unlock(&timer_lock);
+        }
+        pthread_mutex_lock(&timer_lock);
+
+        if ((wheel_wake = wheel_next()) == UINT64_MAX) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+        }
+        else if (wheel_wake > wheel_clock()) {
+            wake = wheel_base_ns + wheel_wake * TIMER_TICK_NS;
+            ts.tv_sec = wake / 1000000000;
+            ts.tv_nsec = wake % 1000000000;
+            pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&timer_lock);
+
+    return NULL;
+}
+
+static pool_timer *timer_start(long delay_ms, long period_ms, void (*somefunction)(void *p), void *p)
+{
+    pool_timer *t = malloc(sizeof(pool_timer));
+
+    if (t == NULL)
+        return NULL;
+
+    t->function = somefunction;
+    t->data = p;
+    t->period = period_ms > 0 ? period_ms * 1000000 / TIMER_TICK_NS : 0;
+    t->cancelled = 0;
+    atomic_init(&t->refs, 2);
+
+    pthread_mutex_lock(&timer_lock);
+    if (timers_stopping) {
+        pthread_mutex_unlock(&timer_lock);
+        free(t);
+        return NULL;
+    }
+
+    // the timer thread is only started once somebody needs it
+    if (! timer_running) {
+        if (wheel_base_ns == 0)
+            wheel_base_ns = now_ns();
+        wheel_tick = wheel_clock();
+        wheel_wake = UINT64_MAX;
+        if (pthread_create(&timer_thread, NULL, timer_main, NULL) != 0) {
+            pthread_mutex_unlock(&timer_lock);
+            free(t);
+            return NULL;
+        }
+        timer_running = 1;
+    }
+    // the timer thread does not advance an empty wheel while it
+    // sleeps; catching up here saves stepping through every idle tick
+    else if (wheel_next() == UINT64_MAX) {
+        wheel_tick = wheel_clock();
+    }
+
+    // never due before the next tick the wheel handles
+    t->expires = wheel_clock() + (delay_ms > 0 ? delay_ms * 1000000 / TIMER_TICK_NS : 0);
+    if (t->expires <= wheel_tick)
+        t->expires = wheel_tick + 1;
+    wheel_schedule(t);
+    pthread_mutex_unlock(&timer_lock);
+
+    return t;
+}
+
+/**
+ * Submits work to the pool to run once, delay_ms from now.
+ * Returns a handle for pool_timer_cancel() that must be released with
+ * pool_timer_release(), or NULL if out of memory or shutting down.
+ */
+pool_timer *pool_submit_after(long delay_ms, void (*somefunction)(void *p), void *p)
+{
+    return timer_start(delay_ms, 0, somefunction, p);
+}
+
+/**
+ * Submits work to the pool to run every period_ms, the first time
+ * period_ms from now, until it is cancelled or the pool shuts down.
+ * A run never overlaps the previous one; runs that a slow previous
+ * one left no time for are skipped.
+ * Returns a handle as for pool_submit_after().
+ */
+pool_timer *pool_submit_every(long period_ms, void (*somefunction)(void *p), void *p)
+{
+    if (period_ms <= 0)
+        return NULL;
+
+    return timer_start(period_ms, period_ms, somefunction, p);
+}
+
+/**
+ * Cancels a timer. A run that has already started is not stopped.
+ * returns 0 if it will not run (again), or 1 if it was a one-shot
+ * timer that has already run or started, or was cancelled before
+ */
+int pool_timer_cancel(pool_timer *t)
+{
+    int rc = 0, release = 0;
+
+    pthread_mutex_lock(&timer_lock);
+    if (t->cancelled || t->state == TIMER_DONE ||
+        (t->state == TIMER_RUNNING && t->period == 0)) {
+        rc = 1;
+    }
+    else if (t->state == TIMER_WAITING) {
+        wheel_remove(t);
+        t->state = TIMER_DONE;
+        release = 1;
+    }
+    t->cancelled = 1;
+    pthread_mutex_unlock(&timer_lock);
+
+    if (release)
+        pool_timer_release(t);
+
+    return rc;
+}
+
+/**
+ * Releases the caller's handle on a timer; it keeps running if it
+ * has not been cancelled.
+ */
+void pool_timer_release(pool_timer *t)
+{
+    if (atomic_fetch_sub(&t->refs, 1) == 1)
+        free(t);
+}
+
+// stop the timer thread and cancel the timers that have not come up
+static void timers_stop(void)
+{
+    pool_timer *t;
+    int level, index;
+
+    pthread_mutex_lock(&timer_lock);
+    timers_stopping = 1;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+
+    if (timer_running)
+        pthread_join(timer_thread, NULL);
+    timer_running = 0;
+
+    pthread_mutex_lock(&timer_lock);
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (index = 0; index < TIMER_SLOTS; index++) {
+            while ((t = wheel[level][index]) != NULL) {
+                wheel_remove(t);
+                t->state = TIMER_DONE;
+                pool_timer_release(t);
+            }
+        }
+    }
+    pthread_mutex_unlock(&timer_lock);
+}
+
+// start the pool with between lo and hi workers
+static void pool_start(int lo, int hi, int linger, const int *plan, int nplan)
+{
+    pthread_condattr_t attr;
+    size_t i;
+    int lane;
+
+    for (lane = 0; lane < POOL_LANES; lane++) {
+        for (i = 0; i < QUEUE_SIZE; i++)
+            atomic_init(&queues[lane].slots[i].seq, i);
+        atomic_init(&queues[lane].head, 0);
+        atomic_init(&queues[lane].tail, 0);
+        atomic_init(&queues[lane].high_water, 0);
+    }
+    atomic_init(&idle_workers, 0);
+    atomic_init(&starting_workers, 0);
+    atomic_init(&shutting_down, 0);
+    atomic_init(&nthreads, 0);
+    atomic_init(&nslots, 0);
+    atomic_init(&rejected, 0);
+    atomic_init(&stranded, NULL);
+
+    min_threads = lo;
+    max_threads = hi;
+    linger_ms = linger;
+
+    for (i = 0; i < nplan; i++)
+        placement[i] = plan[i];
+    nplacement = nplan;
+
+    atomic_init(&wake_epoch, 0);
+
+    atomic_init(&completed, NULL);
+    atomic_init(&completion_signalled, 0);
+    completed_taken = NULL;
+    completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    atomic_init(&blocked_producers, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&space_cond, &attr);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    timers_stopping = 0;
+
+    // every deque must be ready before any worker can steal from it
+    for (i = 0; i < MAX_THREADS; i++) {
+        bees[i].dq = NULL;
+        bees[i].seed = i + 1;
+        bees[i].picks = 0;
+        bees[i].spins = SPIN_MIN;
+        memset(&bees[i].stats, 0, sizeof(bee_stats));
+        bees[i].state = BEE_FREE;
+    }
+
+    pthread_mutex_lock(&resize_lock);
+    for (i = 0; i < lo; i++)
+        start_bee();
+    pthread_mutex_unlock(&resize_lock);
+}
+
+// initialize the thread pool
+void pool_init(void)
+{
+    pool_init_fixed(NUMBER_OF_THREADS);
+}
+
+// initialize the thread pool with nthreads workers, like pool_init()
+void pool_init_fixed(int nthreads)
+{
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    pool_start(nthreads, nthreads, 0, NULL, 0);
+}
+
+/**
+ * Initializes an elastic thread pool. It starts min_threads workers,
+ * adds workers up to max_threads while tasks wait in the queue with
+ * no worker idle, and retires workers that stay idle for linger_ms
+ * until it is back at min_threads.
+ */
+void pool_init_elastic(int min_threads, int max_threads, int linger_ms)
+{
+    if (min_threads < 1)
+        min_threads = 1;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    if (max_threads < min_threads)
+        max_threads = min_threads;
+    if (linger_ms < 1)
+        linger_ms = 1;
+
+    pool_start(min_threads, max_threads, linger_ms, NULL, 0);
+}
+
+// where a CPU sits in the machine
+typedef struct
+{
+    int cpu;
+    int package;
+    int core;
+    int core_rank;          // index of the core within its package
+    int smt;                // index of the CPU within its core
+}
+cpu_info;
+
+static int read_topology(int cpu, const char *name, int fallback)
+{
+    char path[128];
+    FILE *f;
+    int value;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    if ((f = fopen(path, "r")) == NULL)
+        return fallback;
+    if (fscanf(f, "%d", &value) != 1)
+        value = fallback;
+    fclose(f);
+
+    return value;
+}
+
+// package, core, hyperthread
+static int compare_compact(const void *a, const void *b)
+{
+    const cpu_info *x = a, *y = b;
+
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->smt - y->smt;
+}
+
+// hyperthread, core, package: consecutive workers land on
+// different packages and different cores first
+static int compare_scatter(const void *a, const void *b)
+{
+    const cpu_info *x = a, *y = b;
+
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    if (x->core_rank != y->core_rank)
+        return x->core_rank - y->core_rank;
+    if (x->package != y->package)
+        return x->package - y->package;
+    return x->cpu - y->cpu;
+}
+
+// order the candidate CPUs for a placement policy
+// returns the number of CPUs written to plan
+static int plan_placement(int policy, const int *cpus, int ncpus, int *plan)
+{
+    cpu_info info[CPU_SETSIZE];
+    cpu_set_t allowed;
+    int i, j, n = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return 0;
+
+    if (cpus != NULL) {
+        cpu_set_t wanted;
+
+        CPU_ZERO(&wanted);
+        for (i = 0; i < ncpus; i++) {
+            if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+                CPU_SET(cpus[i], &wanted);
+        }
+        CPU_AND(&allowed, &allowed, &wanted);
+    }
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (! CPU_ISSET(i, &allowed))
+            continue;
+        info[n].cpu = i;
+        info[n].package = read_topology(i, "physical_package_id", 0);
+        info[n].core = read_topology(i, "core_id", i);
+        n++;
+    }
+
+    // the CPUs are in id order, so ranks follow the ids too
+    for (i = 0; i < n; i++) {
+        info[i].smt = 0;
+        for (j = 0; j < i; j++) {
+            if (info[j].package == info[i].package && info[j].core == info[i].core)
+                info[i].smt++;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        info[i].core_rank = 0;
+        for (j = 0; j < n; j++) {
+            if (info[j].package == info[i].package && info[j].core < info[i].core && info[j].smt == 0)
+                info[i].core_rank++;
+        }
+    }
+
+    switch (policy) {
+    case POOL_AFFINITY_LIST:
+        // keep the caller's order
+        n = 0;
+        for (i = 0; cpus != NULL && i < ncpus && n < MAX_THREADS; i++) {
+            if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed))
+                plan[n++] = cpus[i];
+        }
+        return n;
+    case POOL_AFFINITY_PHYSICAL:
+        qsort(info, n, sizeof(cpu_info), compare_scatter);
+        for (i = 0, j = 0; i < n && j < MAX_THREADS; i++) {
+            if (info[i].smt == 0)
+                plan[j++] = info[i].cpu;
+        }
+        return j;
+    case POOL_AFFINITY_COMPACT:
+        qsort(info, n, sizeof(cpu_info), compare_compact);
+        break;
+    case POOL_AFFINITY_SCATTER:
+        qsort(info, n, sizeof(cpu_info), compare_scatter);
+        break;
+    default:
+        return 0;
+    }
+
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+    for (i = 0; i < n; i++)
+        plan[i] = info[i].cpu;
+
+    return n;
+}
+
+/**
+ * Initializes the thread pool with pinned workers.
+ *
+ * policy is one of
+ *  POOL_AFFINITY_LIST      worker i runs on cpus[i]
+ *  POOL_AFFINITY_PHYSICAL  one worker per physical core
+ *  POOL_AFFINITY_COMPACT   fill the hyperthreads of a core, then the
+ *                          next core, then the next package
+ *  POOL_AFFINITY_SCATTER   spread over packages, then cores, then
+ *                          hyperthreads
+ *
+ * For the other policies cpus, if not NULL, limits the CPUs that may
+ * be used. nthreads workers are started, placed round-robin over the
+ * chosen CPUs, or one per chosen CPU if nthreads is 0. Each worker
+ * faults in its own deque after it is pinned, so the deque is
+ * allocated on the worker's NUMA node.
+ * returns 0 if successful or 1 if no usable CPU was found
+ */
+int pool_init_affinity(int nthreads, int policy, const int *cpus, int ncpus)
+{
+    int plan[MAX_THREADS];
+    int nplan = plan_placement(policy, cpus, ncpus, plan);
+
+    if (nplan == 0)
+        return 1;
+
+    if (nthreads <= 0)
+        nthreads = nplan;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    pool_start(nthreads, nthreads, 0, plan, nplan);
+
+    return 0;
+}
+
+/**
+ * Fills in the pool statistics gathered since pool initialization.
+ * Workers are listed by slot, including slots whose elastic worker
+ * has retired. The counters are read without stopping the workers,
+ * so they may be a few tasks apart from each other.
+ */
+void pool_get_stats(pool_stats *stats)
+{
+    int i, j;
+
+    memset(stats, 0, sizeof(pool_stats));
+
+    stats->nworkers = atomic_load(&nslots);
+    for (i = 0; i < stats->nworkers; i++) {
+        bee_stats *st = &bees[i].stats;
+
+        stats->workers[i].tasks = atomic_load_explicit(&st->tasks, memory_order_relaxed);
+        stats->workers[i].busy_ns = atomic_load_explicit(&st->busy_ns, memory_order_relaxed);
+        stats->workers[i].idle_ns = atomic_load_explicit(&st->idle_ns, memory_order_relaxed);
+
+        for (j = 0; j < POOL_HISTOGRAM_BUCKETS; j++) {
+            stats->wait[j] += atomic_load_explicit(&st->wait[j], memory_order_relaxed);
+            stats->run[j] += atomic_load_explicit(&st->run[j], memory_order_relaxed);
+        }
+    }
+
+    // producers only sample the depth, so take one more sample now
+    for (i = 0; i < POOL_LANES; i++) {
+        raise_high_water(&queues[i], atomic_load_explicit(&queues[i].tail, memory_order_relaxed));
+        stats->queue_high_water[i] = atomic_load_explicit(&queues[i].high_water, memory_order_relaxed);
+    }
+    stats->rejected = atomic_load_explicit(&rejected, memory_order_relaxed);
+}
+
+// hand a task that will not run back to the caller of
+// pool_shutdown_mode() and settle what was waiting on it
+static void drop_task(task *t, void (*dropped)(void (*somefunction)(void *p), void *p, void *ctx), void *ctx)
+{
+    if (t->function == batch_run) {
+        batch *b = t->data;
+        int i, n = 0;
+
+        while ((i = atomic_fetch_add(&b->next, 1)) < b->n) {
+            if (dropped != NULL)
+                dropped(b->function, b->data[i], ctx);
+            n++;
+        }
+        if (n > 0)
+            future_complete(b->future, n);
+        batch_release(b);
+    }
+    else if (t->function == loop_run) {
+        // the thread that started the loop finishes it by itself
+        loop_release(t->data);
+    }
+    else if (t->function == fiber_run) {
+        fiber *f = t->data;
+
+        // a fiber that has started cannot be unwound, only freed
+        if (dropped != NULL && ! f->started)
+            dropped(f->function, f->data, ctx);
+        fiber_free(f);
+    }
+    else if (t->function == timer_run) {
+        pool_timer *timer = t->data;
+
+        if (dropped != NULL && ! timer->cancelled)
+            dropped(timer->function, timer->data, ctx);
+        timer->state = TIMER_DONE;
+        pool_timer_release(timer);
+    }
+    else {
+        if (dropped != NULL)
+            dropped(t->function, t->data, ctx);
+        if (t->future != NULL)
+            future_complete(t->future, 1);
+    }
+
+    node_free(t);
+}
+
+// shutdown the thread pool
+// queued tasks are run before the workers exit
+void pool_shutdown(void)
+{
+    pool_shutdown_mode(POOL_SHUTDOWN_DRAIN, NULL, NULL);
+}
+
+/**
+ * Shuts down the thread pool.
+ *
+ * POOL_SHUTDOWN_DRAIN runs every queued task before the workers exit.
+ * POOL_SHUTDOWN_ABORT lets the workers finish the task they are
+ * running and then calls dropped(function, p, ctx), if not NULL, for
+ * each task that never started; p is only valid during the call for
+ * tasks from pool_submit_copy(). Futures of dropped tasks are
+ * completed so that nobody waits on them forever.
+ *
+ * Once shutdown has begun, submits fail, except that during a drain
+ * the tasks that are running may still submit. A submit from outside
+ * the pool that raced with the workers exiting is dropped like an
+ * aborted task.
+ */
+void pool_shutdown_mode(int mode,
+    void (*dropped)(void (*somefunction)(void *p), void *p, void *ctx), void *ctx)
+{
+    task *t, *next;
+    int i, lane;
+
+    // timers that have not come up are cancelled, not run
+    timers_stop();
+
+    pthread_mutex_lock(&resize_lock);
+    atomic_store(&shutting_down, mode == POOL_SHUTDOWN_ABORT ? SHUTDOWN_ABORT : SHUTDOWN_DRAIN);
+    pthread_mutex_unlock(&resize_lock);
+
+    // producers blocked on a full queue give up
+    pthread_mutex_lock(&space_lock);
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&space_lock);
+
+    atomic_fetch_add(&wake_epoch, 1);
+    syscall(SYS_futex, &wake_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+    for (i = 0; i < MAX_THREADS; i++) {
+        if (bees[i].state != BEE_FREE)
+            pthread_join(bees[i].thread,NULL);
+        bees[i].state = BEE_FREE;
+    }
+
+    // whatever is left was never started: everything in an abort,
+    // and in a drain what a submit from outside slipped in as the
+    // workers exited. Dropping a task releases graph tasks that wait
+    // on it, which an abort strands, so go round until nothing turns up
+    for (;;) {
+        int found = 0;
+
+        for (t = atomic_exchange(&stranded, NULL); t != NULL; t = next, found++) {
+            next = t->next;
+            drop_task(t, dropped, ctx);
+        }
+        for (lane = 0; lane < POOL_LANES; lane++) {
+            for (; dequeue(lane, &t) == 0; found++)
+                drop_task(t, dropped, ctx);
+        }
+        for (i = 0; i < MAX_THREADS; i++) {
+            for (; bees[i].dq != NULL && (t = deque_steal(bees[i].dq)) != NULL; found++)
+                drop_task(t, dropped, ctx);
+        }
+        if (found == 0)
+            break;
+    }
+
+    // only now that no worker can steal from them
+    for (i = 0; i < MAX_THREADS; i++) {
+        if (bees[i].dq != NULL)
+            munmap(bees[i].dq, sizeof(deque));
+        bees[i].dq = NULL;
+    }
+
+    pthread_cond_destroy(&space_cond);
+    pthread_cond_destroy(&timer_cond);
+
+    // completions nobody collected
+    for (t = atomic_exchange(&completed, NULL); t != NULL; t = next) {
+        next = t->next;
+        node_free(t);
+    }
+    for (t = completed_taken; t != NULL; t = next) {
+        next = t->next;
+        node_free(t);
+    }
+    completed_taken = NULL;
+    close(completion_fd);
+    completion_fd = -1;
 }
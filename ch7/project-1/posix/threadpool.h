@@ -1,6 +1,107 @@
+#include <stddef.h>
+
+// completion handle for submitted work
+typedef struct pool_future pool_future;
+
+// handle for work submitted with pool_submit_after() or pool_submit_every()
+typedef struct pool_timer pool_timer;
+
+// waiting on these from a fiber suspends it instead of its worker
+typedef struct pool_event pool_event;
+typedef struct pool_mutex pool_mutex;
+
+// priority lanes for pool_submit_priority(); pool_submit() uses
+// POOL_PRIORITY_NORMAL
+#define POOL_PRIORITY_HIGH      0
+#define POOL_PRIORITY_NORMAL    1
+#define POOL_PRIORITY_LOW       2
+#define POOL_LANES              3
+
+// worker placement policies for pool_init_affinity()
+#define POOL_AFFINITY_LIST      0
+#define POOL_AFFINITY_PHYSICAL  1
+#define POOL_AFFINITY_COMPACT   2
+#define POOL_AFFINITY_SCATTER   3
+
+// upper limit on the number of workers
+#define POOL_MAX_THREADS        64
+
+// bucket i of a latency histogram counts latencies in [2^i, 2^(i+1)) ns;
+// bucket 0 also counts 0 and the last bucket everything above
+#define POOL_HISTOGRAM_BUCKETS  32
+
+// what one worker has done
+typedef struct
+{
+    unsigned long long tasks;       // tasks executed
+    unsigned long long busy_ns;     // time spent running tasks
+    unsigned long long idle_ns;     // time spent looking for or waiting for tasks
+}
+pool_worker_stats;
+
+// filled in by pool_get_stats()
+typedef struct
+{
+    int nworkers;
+    pool_worker_stats workers[POOL_MAX_THREADS];
+    unsigned long long wait[POOL_HISTOGRAM_BUCKETS];    // submit to start
+    unsigned long long run[POOL_HISTOGRAM_BUCKETS];     // start to finish
+    unsigned long long queue_high_water[POOL_LANES];    // deepest each lane's work queue was seen
+    unsigned long long rejected;                        // submits that found the pool full or shut down
+}
+pool_stats;
+
+// arguments up to this size are copied into the task node
+// by pool_submit_copy()
+#define POOL_INLINE_ARG         48
+
+// how pool_shutdown_mode() treats tasks that have not started
+#define POOL_SHUTDOWN_DRAIN     0
+#define POOL_SHUTDOWN_ABORT     1
+
 // function prototypes
 void execute(void (*somefunction)(void *p), void *p);
 int pool_submit(void (*somefunction)(void *p), void *p);
+int pool_submit_copy(void (*somefunction)(void *p), const void *p, size_t size);
+int pool_submit_timed(void (*somefunction)(void *p), void *p, int timeout_ms);
+int pool_submit_priority(void (*somefunction)(void *p), void *p, int priority);
+int pool_submit_completion(void (*somefunction)(void *p), void *p);
+int pool_completion_fd(void);
+int pool_get_completions(void *p[], int n);
+pool_future *pool_submit_future(void (*somefunction)(void *p), void *p);
+pool_future *pool_submit_batch(void (*somefunction)(void *p), void *p[], int n);
+pool_timer *pool_submit_after(long delay_ms, void (*somefunction)(void *p), void *p);
+pool_timer *pool_submit_every(long period_ms, void (*somefunction)(void *p), void *p);
+int pool_timer_cancel(pool_timer *t);
+void pool_timer_release(pool_timer *t);
+pool_future *pool_task_create(void (*somefunction)(void *p), void *p);
+int pool_task_after(pool_future *t, pool_future *deps[], int n);
+void pool_task_submit(pool_future *t);
+int pool_spawn(void (*somefunction)(void *p), void *p);
+void pool_yield(void);
+pool_event *pool_event_create(void);
+void pool_event_set(pool_event *e);
+void pool_event_wait(pool_event *e);
+void pool_event_destroy(pool_event *e);
+pool_mutex *pool_mutex_create(void);
+void pool_mutex_lock(pool_mutex *m);
+void pool_mutex_unlock(pool_mutex *m);
+void pool_mutex_destroy(pool_mutex *m);
+int pool_future_poll(pool_future *f);
+void pool_future_wait(pool_future *f);
+void pool_future_release(pool_future *f);
+void pool_parallel_for(long begin, long end, long grain,
+    void (*fn)(long begin, long end, void *ctx), void *ctx);
+void pool_parallel_reduce(long begin, long end, long grain,
+    void (*fn)(long begin, long end, void *acc, void *ctx),
+    void (*combine)(void *acc, const void *other, void *ctx),
+    void *result, size_t size, void *ctx);
 void *worker(void *param);
 void pool_init(void);
+void pool_init_fixed(int nthreads);
+void pool_init_elastic(int min_threads, int max_threads, int linger_ms);
+int pool_init_affinity(int nthreads, int policy, const int *cpus, int ncpus);
+void pool_get_stats(pool_stats *stats);
 void pool_shutdown(void);
+void pool_shutdown_mode(int mode,
+    void (*dropped)(void (*somefunction)(void *p), void *p, void *ctx), void *ctx);